@@ -0,0 +1,22 @@
+#include "Batch.hpp"
+
+#include <iostream>
+#include <memory>
+
+int main(int argc, char ** argv) {
+
+    L_LEVEL(INFO);
+
+    auto batch = std::make_unique<Batch>();
+    try {
+        batch->Init(argc, argv);
+        batch->Run();
+        batch->Quit();
+    }
+    catch (std::exception & e) {
+        std::cerr << "gravSimBatch: " << e.what() << "\n";
+        return 1;
+    }
+
+    return 0;
+}
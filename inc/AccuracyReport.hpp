@@ -0,0 +1,144 @@
+#ifndef ACCURACY_REPORT_HPP
+#define ACCURACY_REPORT_HPP
+
+#include "BarnesHutEngine.hpp"
+#include "FmmEngine.hpp"
+#include "PmEngine.hpp"
+#include "ForceEngine.hpp"
+#include "Particles.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <vector>
+
+#include <cmath>
+#include <cstdio>
+
+// Relative error of every live body's acceleration against (rx, ry), sorted;
+// bodies the reference leaves unaccelerated are skipped.
+inline void RelativeForceErrors(const Particles & b, const std::vector<double> & rx, const std::vector<double> & ry, std::vector<double> & error) {
+    error.clear();
+    for (size_t i = 0; i < b.Size(); ++i) {
+        const double norm = sqrt(rx[i] * rx[i] + ry[i] * ry[i]);
+        if (b.alive[i] == 0 || norm <= 0.0) {
+            continue;
+        }
+        const double dx = b.ax[i] - rx[i];
+        const double dy = b.ay[i] - ry[i];
+        error.push_back(sqrt(dx * dx + dy * dy) / norm);
+    }
+    std::sort(error.begin(), error.end());
+}
+
+// One sweep of a solver's settings against a reference engine: times the
+// reference once on a copy of the bodies, then prints a row of error
+// percentiles, time and speedup for each evaluation asked of it.
+class AccuracySweep {
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    Particles b_;
+    std::vector<double> rx_, ry_;
+    std::vector<double> error_;
+    double reference_time_;
+
+public:
+    AccuracySweep(const Particles & bodies, ForceEngine & reference) : b_(bodies) {
+        const auto start = Clock::now();
+        reference.Compute(b_);
+        reference_time_ = std::chrono::duration<double>(Clock::now() - start).count();
+        rx_.assign(b_.ax.Data(), b_.ax.Data() + b_.Size());
+        ry_.assign(b_.ay.Data(), b_.ay.Data() + b_.Size());
+    }
+    ~AccuracySweep() {}
+    // The copy the sweep measures on, e.g. for a warm-up evaluation.
+    Particles & Bodies() {
+        return b_;
+    }
+    double ReferenceTime() const {
+        return reference_time_;
+    }
+    // Evaluates with `engine` and prints `label`, the median, p99 and max
+    // error, whatever extra(out, bodies) prints for the solver, then the time
+    // and speedup. Nothing is printed if no body could be measured.
+    template<typename Extra>
+    void Row(ForceEngine & engine, const char * label, Extra extra, FILE * out) {
+        const auto start = Clock::now();
+        engine.Compute(b_);
+        const double time = std::chrono::duration<double>(Clock::now() - start).count();
+
+        RelativeForceErrors(b_, rx_, ry_, error_);
+        if (error_.empty()) {
+            return;
+        }
+        fprintf(out, "  %s %10.2e %10.2e %10.2e", label, error_[error_.size() / 2], error_[error_.size() * 99 / 100], error_.back());
+        extra(out, error_.size());
+        fprintf(out, " %8.3f %8.1f\n", time, time > 0.0 ? reference_time_ / time : 0.0);
+    }
+};
+
+// Relative force error of the tree against a reference engine (normally exact
+// direct summation) for every moment order over a range of opening angles,
+// with the cost of each setting. Works on a copy, so the bodies and the
+// engine's settings are left as they were.
+inline void TreeAccuracyReport(const Particles & bodies, BarnesHutEngine & tree, ForceEngine & reference, FILE * out) {
+    const double thetas[] = { 0.2, 0.3, 0.4, 0.5, 0.6, 0.7, 0.8, 1.0 };
+
+    AccuracySweep sweep(bodies, reference);
+    const double theta = tree.GetTheta();
+    const int moments = tree.GetMoments();
+    fprintf(out, "Tree accuracy against %s, %zu bodies, %.3f s, group size %zu:\n", reference.Name(), bodies.Alive(), sweep.ReferenceTime(), tree.GetGroupSize());
+    fprintf(out, "  %-10s %5s %10s %10s %10s %10s %8s %8s\n", "moments", "theta", "median", "p99", "max", "inter/body", "time", "speedup");
+    for (int m = BarnesHutEngine::moments__MONOPOLE; m <= BarnesHutEngine::moments__OCTUPOLE; ++m) {
+        for (const double t : thetas) {
+            tree.SetMoments(m);
+            tree.SetTheta(t);
+            char label[32];
+            snprintf(label, sizeof(label), "%-10s %5.2f", BarnesHutEngine::MomentsName(m), t);
+            sweep.Row(tree, label, [&](FILE * f, const size_t count) {
+                fprintf(f, " %10.1f", static_cast<double>(tree.Interactions()) / count);
+            }, out);
+        }
+    }
+    tree.SetMoments(moments);
+    tree.SetTheta(theta);
+}
+
+// The same for the multipole solver over its expansion orders at its current
+// opening angle.
+inline void FmmAccuracyReport(const Particles & bodies, FmmEngine & fmm, ForceEngine & reference, FILE * out) {
+    AccuracySweep sweep(bodies, reference);
+    const int order = fmm.GetOrder();
+    fprintf(out, "FMM accuracy against %s, %zu bodies, %.3f s, theta %.2f:\n", reference.Name(), bodies.Alive(), sweep.ReferenceTime(), fmm.GetTheta());
+    fprintf(out, "  %5s %10s %10s %10s %10s %10s %8s %8s\n", "order", "median", "p99", "max", "pairs/body", "M2L/body", "time", "speedup");
+    for (int p = FmmEngine::k_MinOrder; p <= FmmEngine::k_MaxOrder; ++p) {
+        fmm.SetOrder(p);
+        char label[32];
+        snprintf(label, sizeof(label), "%5d", p);
+        sweep.Row(fmm, label, [&](FILE * f, const size_t count) {
+            fprintf(f, " %10.1f %10.2f", static_cast<double>(fmm.Interactions()) / count, static_cast<double>(fmm.Translations()) / count);
+        }, out);
+    }
+    fmm.SetOrder(order);
+}
+
+// The same for a mesh solver over mesh sizes.
+inline void MeshAccuracyReport(const Particles & bodies, PmEngine & pm, ForceEngine & reference, FILE * out) {
+    AccuracySweep sweep(bodies, reference);
+    const size_t mesh = pm.GetMesh();
+    fprintf(out, "%s accuracy against %s, %zu bodies, %.3f s:\n", pm.Name(), reference.Name(), bodies.Alive(), sweep.ReferenceTime());
+    fprintf(out, "  %5s %10s %10s %10s %10s %8s %8s\n", "mesh", "median", "p99", "max", "spacing", "time", "speedup");
+    for (size_t m = PmEngine::k_MinMesh * 2; m <= PmEngine::k_MaxMesh / 2; m *= 2) {
+        pm.SetMesh(m);
+        // The first evaluation at a new size also transforms the kernel.
+        pm.Compute(sweep.Bodies());
+        char label[32];
+        snprintf(label, sizeof(label), "%5zu", m);
+        sweep.Row(pm, label, [&](FILE * f, const size_t) {
+            fprintf(f, " %10.3g", pm.Spacing());
+        }, out);
+    }
+    pm.SetMesh(mesh);
+}
+
+#endif // ACCURACY_REPORT_HPP
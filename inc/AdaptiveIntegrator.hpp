@@ -0,0 +1,257 @@
+#ifndef ADAPTIVE_INTEGRATOR_HPP
+#define ADAPTIVE_INTEGRATOR_HPP
+
+#include "AlignedArray.hpp"
+#include "Integrator.hpp"
+#include "Logger.hpp"
+
+#include <algorithm>
+
+#include <cmath>
+#include <cstdint>
+
+// Dormand-Prince 5(4) embedded Runge-Kutta with step-size control. Each
+// Step(dt) is covered by as many internal steps as the tolerance needs, so
+// dt only sets how often the front-end sees the bodies; quiet stretches take
+// a few long steps and close encounters many short ones.
+//
+// The fifth order solution is kept and the embedded fourth order one only
+// estimates the error. That estimate is the largest over bodies of the
+// position and velocity error, measured against the tolerance times the RMS
+// distance and speed of the bodies about their barycentre. A step whose
+// error exceeds one is rejected and retried shorter; the next step length is
+// 0.9 err^(-1/5) of the last, within [0.2, 5] of it. The last stage is the
+// first of the next step (FSAL), so an accepted step costs six evaluations
+// and a rejected one six more.
+class DormandPrinceIntegrator : public Integrator {
+private:
+    enum {
+        k_Stages = 7,
+    };
+    const double k_Safety = 0.9;
+    const double k_MinFactor = 0.2;
+    const double k_MaxFactor = 5.0;
+
+    double tolerance_;
+    AdaptiveStepper stepper_;
+    AlignedArray<double> x0_, y0_, vx0_, vy0_;
+    AlignedArray<double> kvx_[k_Stages], kvy_[k_Stages];  // stage velocities
+    AlignedArray<double> kax_[k_Stages], kay_[k_Stages];  // stage accelerations
+    AlignedArray<double> error_;
+    uint64_t evaluations_;
+
+    double a_[k_Stages][k_Stages];
+    double e_[k_Stages];             // fifth minus fourth order weights
+
+public:
+    DormandPrinceIntegrator()
+    : tolerance_(1e-9)
+    , stepper_("DormandPrinceIntegrator")
+    , evaluations_(0)
+    {
+        for (int i = 0; i < k_Stages; ++i) {
+            for (int j = 0; j < k_Stages; ++j) {
+                a_[i][j] = 0.0;
+            }
+        }
+        a_[1][0] = 1.0 / 5.0;
+        a_[2][0] = 3.0 / 40.0;
+        a_[2][1] = 9.0 / 40.0;
+        a_[3][0] = 44.0 / 45.0;
+        a_[3][1] = -56.0 / 15.0;
+        a_[3][2] = 32.0 / 9.0;
+        a_[4][0] = 19372.0 / 6561.0;
+        a_[4][1] = -25360.0 / 2187.0;
+        a_[4][2] = 64448.0 / 6561.0;
+        a_[4][3] = -212.0 / 729.0;
+        a_[5][0] = 9017.0 / 3168.0;
+        a_[5][1] = -355.0 / 33.0;
+        a_[5][2] = 46732.0 / 5247.0;
+        a_[5][3] = 49.0 / 176.0;
+        a_[5][4] = -5103.0 / 18656.0;
+        // The last row is the fifth order solution itself.
+        a_[6][0] = 35.0 / 384.0;
+        a_[6][2] = 500.0 / 1113.0;
+        a_[6][3] = 125.0 / 192.0;
+        a_[6][4] = -2187.0 / 6784.0;
+        a_[6][5] = 11.0 / 84.0;
+        e_[0] = 71.0 / 57600.0;
+        e_[1] = 0.0;
+        e_[2] = -71.0 / 16695.0;
+        e_[3] = 71.0 / 1920.0;
+        e_[4] = -17253.0 / 339200.0;
+        e_[5] = 22.0 / 525.0;
+        e_[6] = -1.0 / 40.0;
+    }
+    ~DormandPrinceIntegrator() {}
+    const char * Name() const override {
+        return "Dormand-Prince 5(4)";
+    }
+    // Relative error allowed per internal step.
+    void SetTolerance(const double & tolerance) {
+        tolerance_ = tolerance;
+    }
+    double GetTolerance() const {
+        return tolerance_;
+    }
+    // Force evaluations and internal steps since construction.
+    uint64_t Evaluations() const {
+        return evaluations_;
+    }
+    uint64_t Accepted() const {
+        return stepper_.Accepted();
+    }
+    uint64_t Rejected() const {
+        return stepper_.Rejected();
+    }
+    void Step(Particles & bodies, ForceEngine & engine, const double & dt) override {
+        const size_t n = bodies.Size();
+        if (n == 0 || dt == 0.0) {
+            return;
+        }
+        if (!valid_ || kax_[0].Size() != n) {
+            Start(bodies, engine);
+        }
+        stepper_.Advance(dt
+            , [&](const double & h, double & next) {
+                const double err = Attempt(bodies, engine, h);
+                const double factor = err > 0.0 ? k_Safety * pow(err, -0.2) : k_MaxFactor;
+                next = h * std::min(k_MaxFactor, std::max(k_MinFactor, factor));
+                return err <= 1.0;
+            }
+            , [&]() {
+                Restore(bodies);
+            }
+            , [&](const double &, const double &) {
+                // FSAL: the last stage opens the next step.
+                kvx_[0].Swap(kvx_[k_Stages - 1]);
+                kvy_[0].Swap(kvy_[k_Stages - 1]);
+                kax_[0].Swap(kax_[k_Stages - 1]);
+                kay_[0].Swap(kay_[k_Stages - 1]);
+            }
+        );
+        // The engine left the accelerations of the final state in bodies.
+    }
+
+private:
+    void Start(Particles & bodies, ForceEngine & engine) {
+        const size_t n = bodies.Size();
+        for (int s = 0; s < k_Stages; ++s) {
+            kvx_[s].Resize(n);
+            kvy_[s].Resize(n);
+            kax_[s].Resize(n);
+            kay_[s].Resize(n);
+        }
+        x0_.Resize(n);
+        y0_.Resize(n);
+        vx0_.Resize(n);
+        vy0_.Resize(n);
+        error_.Resize(n);
+        engine.Compute(bodies);
+        ++evaluations_;
+        kvx_[0] = bodies.vx;
+        kvy_[0] = bodies.vy;
+        kax_[0] = bodies.ax;
+        kay_[0] = bodies.ay;
+        valid_ = true;
+    }
+    // Takes one step of h from the current state, leaving the fifth order
+    // result in bodies, and returns the scaled error estimate.
+    double Attempt(Particles & bodies, ForceEngine & engine, const double & h) {
+        const size_t n = bodies.Size();
+        x0_ = bodies.x;
+        y0_ = bodies.y;
+        vx0_ = bodies.vx;
+        vy0_ = bodies.vy;
+
+        for (int s = 1; s < k_Stages; ++s) {
+            const double * a = a_[s];
+            ParallelFor(pool_.get(), 0, n, k_StreamGrain, [&](size_t begin, size_t end) {
+                for (size_t i = begin; i < end; ++i) {
+                    double dx = 0.0, dy = 0.0, dvx = 0.0, dvy = 0.0;
+                    for (int j = 0; j < s; ++j) {
+                        dx += a[j] * kvx_[j][i];
+                        dy += a[j] * kvy_[j][i];
+                        dvx += a[j] * kax_[j][i];
+                        dvy += a[j] * kay_[j][i];
+                    }
+                    bodies.x[i] = x0_[i] + h * dx;
+                    bodies.y[i] = y0_[i] + h * dy;
+                    bodies.vx[i] = vx0_[i] + h * dvx;
+                    bodies.vy[i] = vy0_[i] + h * dvy;
+                }
+            });
+            engine.Compute(bodies);
+            ++evaluations_;
+            kvx_[s] = bodies.vx;
+            kvy_[s] = bodies.vy;
+            kax_[s] = bodies.ax;
+            kay_[s] = bodies.ay;
+        }
+        return Error(bodies, h);
+    }
+    void Restore(Particles & bodies) {
+        bodies.x = x0_;
+        bodies.y = y0_;
+        bodies.vx = vx0_;
+        bodies.vy = vy0_;
+    }
+    double Error(const Particles & bodies, const double & h) {
+        const size_t n = bodies.Size();
+        // Scales: RMS distance and speed about the barycentre.
+        double mass = 0.0, cx = 0.0, cy = 0.0, cvx = 0.0, cvy = 0.0;
+        size_t live = 0;
+        for (size_t i = 0; i < n; ++i) {
+            if (bodies.alive[i] == 0) {
+                continue;
+            }
+            const double m = bodies.m[i];
+            mass += m;
+            cx += m * x0_[i];
+            cy += m * y0_[i];
+            cvx += m * vx0_[i];
+            cvy += m * vy0_[i];
+            ++live;
+        }
+        if (live == 0 || mass <= 0.0) {
+            return 0.0;
+        }
+        cx /= mass;
+        cy /= mass;
+        cvx /= mass;
+        cvy /= mass;
+        double r2 = 0.0, v2 = 0.0;
+        for (size_t i = 0; i < n; ++i) {
+            if (bodies.alive[i] == 0) {
+                continue;
+            }
+            r2 += (x0_[i] - cx) * (x0_[i] - cx) + (y0_[i] - cy) * (y0_[i] - cy);
+            v2 += (vx0_[i] - cvx) * (vx0_[i] - cvx) + (vy0_[i] - cvy) * (vy0_[i] - cvy);
+        }
+        const double tol = tolerance_;
+        const double inv_r = r2 > 0.0 ? 1.0 / (tol * sqrt(r2 / live)) : 0.0;
+        const double inv_v = v2 > 0.0 ? 1.0 / (tol * sqrt(v2 / live)) : 0.0;
+
+        ParallelFor(pool_.get(), 0, n, k_StreamGrain, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; ++i) {
+                double ex = 0.0, ey = 0.0, evx = 0.0, evy = 0.0;
+                for (int j = 0; j < k_Stages; ++j) {
+                    ex += e_[j] * kvx_[j][i];
+                    ey += e_[j] * kvy_[j][i];
+                    evx += e_[j] * kax_[j][i];
+                    evy += e_[j] * kay_[j][i];
+                }
+                const double er = h * sqrt(ex * ex + ey * ey) * inv_r;
+                const double ev = h * sqrt(evx * evx + evy * evy) * inv_v;
+                error_[i] = bodies.alive[i] != 0 ? std::max(fabs(er), fabs(ev)) : 0.0;
+            }
+        });
+        double err = 0.0;
+        for (size_t i = 0; i < n; ++i) {
+            err = std::max(err, error_[i]);
+        }
+        return err;
+    }
+};
+
+#endif // ADAPTIVE_INTEGRATOR_HPP
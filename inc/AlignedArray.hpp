@@ -0,0 +1,144 @@
+#ifndef ALIGNED_ARRAY_HPP
+#define ALIGNED_ARRAY_HPP
+
+#include "CustomException.hpp"
+
+#include <type_traits>
+#include <utility>
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+
+// Growable array of trivially copyable elements whose storage starts on an
+// Alignment byte boundary, so kernels can stream it with aligned vector loads.
+template<typename T, size_t Alignment = 64>
+class AlignedArray {
+    static_assert(std::is_trivially_copyable<T>::value, "AlignedArray needs trivially copyable elements.");
+    static_assert((Alignment & (Alignment - 1)) == 0, "Alignment must be a power of two.");
+
+private:
+    T * data_;
+    size_t size_;
+    size_t capacity_;
+
+public:
+    AlignedArray() : data_(nullptr), size_(0), capacity_(0) {}
+    AlignedArray(const AlignedArray & other) : AlignedArray() {
+        *this = other;
+    }
+    AlignedArray(AlignedArray && other) : AlignedArray() {
+        Swap(other);
+    }
+    ~AlignedArray() {
+        Free(data_);
+    }
+    AlignedArray & operator=(const AlignedArray & other) {
+        if (this != &other) {
+            Resize(other.size_);
+            if (size_ > 0) {
+                memcpy(data_, other.data_, size_ * sizeof(T));
+            }
+        }
+        return *this;
+    }
+    AlignedArray & operator=(AlignedArray && other) {
+        Swap(other);
+        return *this;
+    }
+    void Swap(AlignedArray & other) {
+        std::swap(data_, other.data_);
+        std::swap(size_, other.size_);
+        std::swap(capacity_, other.capacity_);
+    }
+
+    T * Data() { return data_; }
+    const T * Data() const { return data_; }
+    size_t Size() const { return size_; }
+    size_t Capacity() const { return capacity_; }
+    bool Empty() const { return size_ == 0; }
+    T & operator[](const size_t i) { return data_[i]; }
+    const T & operator[](const size_t i) const { return data_[i]; }
+
+    void Reserve(const size_t capacity) {
+        if (capacity <= capacity_) {
+            return;
+        }
+        T * data = Allocate(capacity);
+        if (size_ > 0) {
+            memcpy(data, data_, size_ * sizeof(T));
+        }
+        Free(data_);
+        data_ = data;
+        capacity_ = capacity;
+    }
+    void Resize(const size_t size) {
+        if (size > capacity_) {
+            Reserve(size);
+        }
+        size_ = size;
+    }
+    void Resize(const size_t size, const T & value) {
+        const size_t old_size = size_;
+        Resize(size);
+        for (size_t i = old_size; i < size_; ++i) {
+            data_[i] = value;
+        }
+    }
+    void PushBack(const T & value) {
+        if (size_ == capacity_) {
+            Reserve(capacity_ == 0 ? k_InitialCapacity : 2 * capacity_);
+        }
+        data_[size_++] = value;
+    }
+    void Fill(const T & value) {
+        for (size_t i = 0; i < size_; ++i) {
+            data_[i] = value;
+        }
+    }
+    void Clear() {
+        size_ = 0;
+    }
+
+private:
+    static const size_t k_InitialCapacity = 64;
+
+    static T * Allocate(const size_t count) {
+        // Leave room for the rounding below as well.
+        if (count > (SIZE_MAX - Alignment) / sizeof(T)) {
+            throw CustomException("Unable to allocate %zu elements of %zu bytes!", count, sizeof(T));
+        }
+        // Round the byte count up so the tail of the last cache line is ours too.
+        size_t bytes = count * sizeof(T);
+        bytes = (bytes + Alignment - 1) & ~(Alignment - 1);
+        void * p = nullptr;
+#ifdef _WIN32
+        p = _aligned_malloc(bytes, Alignment);
+#else
+        if (posix_memalign(&p, Alignment < sizeof(void*) ? sizeof(void*) : Alignment, bytes) != 0) {
+            p = nullptr;
+        }
+#endif
+        if (p == nullptr) {
+            throw CustomException("Unable to allocate %zu aligned bytes!", bytes);
+        }
+        return static_cast<T *>(p);
+    }
+    static void Free(T * p) {
+        if (p == nullptr) {
+            return;
+        }
+#ifdef _WIN32
+        _aligned_free(p);
+#else
+        free(p);
+#endif
+    }
+};
+
+#endif // ALIGNED_ARRAY_HPP
@@ -19,6 +19,7 @@ public:
         InitDisplay();
         sim_ = std::make_shared<GravSim>();
         sim_->Init();
+        sim_->Start(dT);
     }
     void Run() {
         while (!DISPLAY.QuitCondition()) {
@@ -36,6 +37,7 @@ public:
         }
     }
     void Quit() {
+        sim_->Quit();
         DISPLAY.Quit();
     }
 
@@ -49,9 +51,8 @@ private:
         DISPLAY.SetPanAndZoom(true);
         DISPLAY.Init();       
     }
-    const double dT = 10.0 * 131.1 / 900.0;
+    const double dT = Simulation::DefaultTimeStep();
     void RenderWorld() {
-        sim_->Step(dT);
         sim_->RenderWorld();
     }
     void RenderUi() {
@@ -0,0 +1,613 @@
+#ifndef BARNES_HUT_ENGINE_HPP
+#define BARNES_HUT_ENGINE_HPP
+
+#include "AlignedArray.hpp"
+#include "ForceEngine.hpp"
+#include "GravityKernel.hpp"
+#include "Morton.hpp"
+#include "RadixSort.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <vector>
+
+#include <cmath>
+#include <cstdint>
+
+// Barnes-Hut tree solver, O(N log N). A cell of side s whose centre of mass
+// lies delta from its geometric centre is replaced by that centre of mass
+// when seen from further than s / theta + delta; theta = 0 opens every cell
+// and reproduces direct summation. The offset term keeps lopsided cells from
+// passing too early, and the opening radius never drops below the cell's
+// reach from its centre of mass, so a cell is never accepted by a body inside
+// it: a plain s / d < theta test allows that above theta ~0.7 and folds the
+// body's own mass into its field.
+//
+// The quadtree is rebuilt from scratch on every evaluation without inserting
+// bodies one by one. Bodies are sorted by Morton key, which lines up every
+// cell's bodies as one contiguous run. Two neighbouring keys share a number
+// of leading quadtree levels; from that count alone each body knows how many
+// cells start at it and what depths they have. A prefix sum over those counts
+// gives every cell its slot in depth-first (pre-order) order. Except for that
+// scan and the final moment sweep, every pass is independent per body or per
+// cell, so it runs on the pool.
+//
+// Cells live in one contiguous pre-order array that is resized, never freed,
+// between evaluations. A cell's first child is the next entry and its skip
+// index jumps past its subtree, so the walk needs neither child pointers nor
+// a stack and moves mostly forward through memory.
+//
+// Accepted cells may optionally add their quadrupole, or quadrupole and
+// octupole, moments about the centre of mass. The error at a given theta then
+// falls by roughly one power of theta per order, so a coarser theta and fewer
+// interactions reach the same accuracy.
+//
+// By default the tree is walked once per group rather than once per body: a
+// group is the largest cell holding at most GetGroupSize() bodies, and a cell
+// is accepted only if it passes the opening test from the nearest point of
+// the group's bounding box, so it would pass for every body in the group.
+// What the walk accepts or reaches in a leaf becomes one shared list of point
+// sources, which GravityKernel evaluates against the whole group. The test is
+// stricter than the per-body one, so a group walk does a little more
+// arithmetic at a given theta and is a little more accurate, but that
+// arithmetic streams through vector units instead of chasing the tree.
+class BarnesHutEngine : public ForceEngine {
+public:
+    enum {
+        moments__MONOPOLE = 0,
+        moments__QUADRUPOLE,
+        moments__OCTUPOLE,
+    };
+
+private:
+    enum {
+        // Quantisation levels per axis; bodies closer than box / 2^31 share
+        // a leaf.
+        k_MaxDepth = 31,
+        k_Grain = 4096,
+        k_WalkGrain = 256,
+        // Groups per pool chunk.
+        k_GroupGrain = 4,
+    };
+    // Half the diagonal of a unit square.
+    const double k_HalfDiagonal = 0.70710678118654752;
+    // Only what the walk reads; two per cache line.
+    struct Node {
+        double mx, my;      // centre of mass
+        double mass;
+        uint32_t skip;      // next node after this subtree; k + 1 for a leaf
+        float open2;        // squared distance below which the cell opens
+    };
+    // Second and third mass moments about the centre of mass; read only for
+    // accepted cells, so they stay out of the walk's way.
+    struct Multipole {
+        double qxx, qxy, qyy;
+        double oxxx, oxxy, oxyy, oyyy;
+    };
+    // One group's interaction list and its gathered targets; one per pool
+    // thread, cleared rather than freed between groups and evaluations.
+    struct Lists {
+        AlignedArray<double> x, y, m;       // point sources
+        AlignedArray<uint32_t> cells;       // accepted cells, for their moments
+        AlignedArray<double> cx, cy;        // their centres and moments, gathered
+        AlignedArray<Multipole> poles;
+        AlignedArray<double> tx, ty, tax, tay;
+        AlignedArray<uint32_t> target;      // sorted position of each target
+    };
+
+    double theta_;
+    int moments_;
+    size_t group_size_;
+    GravityKernel kernel_;
+    std::atomic<uint64_t> interactions_;
+    AlignedArray<Node> nodes_;
+    AlignedArray<Multipole> poles_;
+    AlignedArray<uint32_t> first_;       // first sorted body of each node
+
+    RadixSorter sorter_;
+    AlignedArray<uint64_t> keys_;
+    AlignedArray<uint32_t> order_;       // sorted position -> body index
+    AlignedArray<double> sx_, sy_, sm_;  // bodies in sorted order
+    AlignedArray<int8_t> common_;        // levels shared with the previous key
+    AlignedArray<uint32_t> offset_;      // first node starting at each body
+    AlignedArray<uint32_t> groups_;      // group root nodes
+    AlignedArray<uint8_t> marked_;       // per body: wanted by ComputeActive()
+    std::vector<std::unique_ptr<Lists>> lists_;  // per pool slot
+
+public:
+    BarnesHutEngine()
+    : theta_(0.5)
+    , moments_(moments__MONOPOLE)
+    , group_size_(64)
+    , interactions_(0)
+    {}
+    ~BarnesHutEngine() {}
+    const char * Name() const override {
+        return "Barnes-Hut";
+    }
+    void SetTheta(const double & theta) {
+        theta_ = theta;
+    }
+    double GetTheta() const {
+        return theta_;
+    }
+    // Highest moment order used for accepted cells, moments__*.
+    void SetMoments(const int moments) {
+        moments_ = std::min(std::max(moments, static_cast<int>(moments__MONOPOLE)), static_cast<int>(moments__OCTUPOLE));
+    }
+    int GetMoments() const {
+        return moments_;
+    }
+    static const char * MomentsName(const int moments) {
+        switch (moments) {
+        case moments__OCTUPOLE: return "Octupole";
+        case moments__QUADRUPOLE: return "Quadrupole";
+        default: return "Monopole";
+        }
+    }
+    // Most bodies sharing one walk; 0 walks the tree once per body.
+    void SetGroupSize(const size_t size) {
+        group_size_ = size;
+    }
+    size_t GetGroupSize() const {
+        return group_size_;
+    }
+    size_t NodeCount() const {
+        return nodes_.Size();
+    }
+    // Body-body and body-cell interactions in the last evaluation.
+    uint64_t Interactions() const {
+        return interactions_;
+    }
+    void Compute(Particles & bodies) override {
+        Build(bodies);
+        if (group_size_ > 0) {
+            ComputeGroups(bodies, false);
+            return;
+        }
+
+        // Walks only read the tree and write their own body, so any split of
+        // the bodies across threads gives the same result.
+        ParallelFor(pool_.get(), 0, bodies.Size(), k_WalkGrain, [&](size_t begin, size_t end) {
+            uint64_t interactions = 0;
+            for (size_t i = begin; i < end; ++i) {
+                interactions += Walk(bodies, i);
+            }
+            interactions_ += interactions;
+        });
+    }
+    // The tree still holds every body; only the listed ones walk it.
+    void ComputeActive(Particles & bodies, const uint32_t * active, const size_t count) override {
+        Build(bodies);
+        if (group_size_ > 0) {
+            marked_.Resize(bodies.Size());
+            marked_.Fill(0);
+            for (size_t k = 0; k < count; ++k) {
+                marked_[active[k]] = 1;
+            }
+            ComputeGroups(bodies, true);
+            return;
+        }
+        ParallelFor(pool_.get(), 0, count, k_WalkGrain, [&](size_t begin, size_t end) {
+            uint64_t interactions = 0;
+            for (size_t k = begin; k < end; ++k) {
+                interactions += Walk(bodies, active[k]);
+            }
+            interactions_ += interactions;
+        });
+    }
+
+private:
+    void Build(const Particles & bodies) {
+        ThreadPool * pool = pool_.get();
+        const size_t n = bodies.Size();
+        const size_t live = bodies.Alive();
+        interactions_ = 0;
+        nodes_.Clear();
+        if (live == 0) {
+            return;
+        }
+
+        // Sort; dead bodies carry the all-ones key and end up past `live`.
+        const MortonBox box = MortonKeys(bodies, pool, k_MaxDepth, keys_);
+        order_.Resize(n);
+        ParallelFor(pool, 0, n, k_Grain, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; ++i) {
+                order_[i] = static_cast<uint32_t>(i);
+            }
+        });
+        sorter_.Sort(pool, keys_, order_);
+
+        sx_.Resize(live);
+        sy_.Resize(live);
+        sm_.Resize(live);
+        common_.Resize(live + 1);
+        offset_.Resize(live + 1);
+        ParallelFor(pool, 0, live, k_Grain, [&](size_t begin, size_t end) {
+            for (size_t k = begin; k < end; ++k) {
+                const uint32_t i = order_[k];
+                sx_[k] = bodies.x[i];
+                sy_[k] = bodies.y[i];
+                sm_[k] = bodies.m[i];
+                common_[k] = static_cast<int8_t>(k == 0 ? -1 : MortonCommonLevels(keys_[k - 1], keys_[k], k_MaxDepth));
+            }
+        });
+        common_[live] = -1;
+
+        // Cells starting at body k have depths common_[k] + 1 .. Top(k): the
+        // ones deeper than what k shares with its predecessor, down to the
+        // first that no longer holds k's successor.
+        uint32_t total = 0;
+        for (size_t k = 0; k < live; ++k) {
+            offset_[k] = total;
+            total += static_cast<uint32_t>(Top(k) - common_[k]);
+        }
+        offset_[live] = total;
+        nodes_.Resize(total);
+        first_.Resize(total + 1);
+        first_[total] = static_cast<uint32_t>(live);
+        poles_.Resize(moments_ > moments__MONOPOLE ? total : 0);
+
+        const double inv_theta = theta_ > 0.0 ? 1.0 / theta_ : HUGE_VAL;
+        ParallelFor(pool, 0, live, k_Grain, [&](size_t begin, size_t end) {
+            for (size_t k = begin; k < end; ++k) {
+                const int top = Top(k);
+                for (int d = common_[k] + 1; d <= top; ++d) {
+                    const uint32_t index = offset_[k] + (d - common_[k] - 1);
+                    Node & node = nodes_[index];
+                    uint32_t count;
+                    if (d == 0) {
+                        count = static_cast<uint32_t>(live);
+                    } else if (d > common_[k + 1]) {
+                        count = 1;
+                    } else {
+                        // Keys within the cell share the prefix; the run ends
+                        // at the first key past it.
+                        const int shift = 2 * (k_MaxDepth - d);
+                        const uint64_t limit = ((keys_[k] >> shift) + 1) << shift;
+                        const uint64_t * last = std::lower_bound(keys_.Data() + k, keys_.Data() + live, limit);
+                        count = static_cast<uint32_t>(last - keys_.Data() - k);
+                    }
+                    node.skip = offset_[k + count];
+                    first_[index] = static_cast<uint32_t>(k);
+                    if (d == k_MaxDepth || count == 1) {
+                        node.open2 = 0.0f;
+                        Leaf(index, k, count);
+                    } else {
+                        // Geometry until the moment sweep replaces it: the
+                        // cell's centre in mx, my and its side in mass.
+                        const double side = box.size / static_cast<double>(uint64_t(1) << d);
+                        const uint64_t cell = keys_[k] >> (2 * (k_MaxDepth - d));
+                        node.mx = box.min_x + (MortonCompact(cell) + 0.5) * side;
+                        node.my = box.min_y + (MortonCompact(cell >> 1) + 0.5) * side;
+                        node.mass = side;
+                    }
+                }
+            }
+        });
+
+        // Children always follow their parent, so a reverse sweep sees every
+        // child before the cell that owns it. The first child is the next
+        // node and each child's skip leads to its next sibling.
+        for (size_t k = total; k-- > 0; ) {
+            Node & node = nodes_[k];
+            if (node.skip == k + 1) {
+                continue;
+            }
+            const double side = node.mass;
+            const double gx = node.mx;
+            const double gy = node.my;
+            double mass = 0.0, mx = 0.0, my = 0.0;
+            for (uint32_t c = static_cast<uint32_t>(k + 1); c < node.skip; c = nodes_[c].skip) {
+                const Node & child = nodes_[c];
+                mass += child.mass;
+                mx += child.mass * child.mx;
+                my += child.mass * child.my;
+            }
+            Moments(node, mass, mx, my);
+            // Every point of the cell lies within half its diagonal of the
+            // geometric centre, so within that plus delta of the centre of
+            // mass. Rounded up to float so that bound survives.
+            const double delta = sqrt((node.mx - gx) * (node.mx - gx) + (node.my - gy) * (node.my - gy));
+            const double reach = std::max(side * inv_theta, side * k_HalfDiagonal) + delta;
+            node.open2 = nextafterf(static_cast<float>(reach * reach), HUGE_VALF);
+            if (!poles_.Empty()) {
+                Shift(k);
+            }
+        }
+    }
+    // Deepest level of the cells starting at sorted body k.
+    int Top(const size_t k) const {
+        return std::min(std::max<int>(common_[k], common_[k + 1]) + 1, static_cast<int>(k_MaxDepth));
+    }
+    void Leaf(const uint32_t index, const size_t first, const uint32_t count) {
+        Node & node = nodes_[index];
+        if (count == 1) {
+            // Exactly the body, so the body itself sees zero separation.
+            node.mx = sx_[first];
+            node.my = sy_[first];
+            node.mass = sm_[first];
+        } else {
+            double mass = 0.0, mx = 0.0, my = 0.0;
+            for (size_t b = first; b < first + count; ++b) {
+                mass += sm_[b];
+                mx += sm_[b] * sx_[b];
+                my += sm_[b] * sy_[b];
+            }
+            Moments(node, mass, mx, my);
+        }
+        if (poles_.Empty()) {
+            return;
+        }
+        Multipole p = {};
+        for (size_t b = first; count > 1 && b < first + count; ++b) {
+            const double sx = sx_[b] - node.mx;
+            const double sy = sy_[b] - node.my;
+            p.qxx += sm_[b] * sx * sx;
+            p.qxy += sm_[b] * sx * sy;
+            p.qyy += sm_[b] * sy * sy;
+            p.oxxx += sm_[b] * sx * sx * sx;
+            p.oxxy += sm_[b] * sx * sx * sy;
+            p.oxyy += sm_[b] * sx * sy * sy;
+            p.oyyy += sm_[b] * sy * sy * sy;
+        }
+        poles_[index] = p;
+    }
+    // Parallel-axis sum of the children's moments about cell k's centre of
+    // mass; each child's own dipole about its centre is zero.
+    void Shift(const size_t k) {
+        const Node & node = nodes_[k];
+        Multipole p = {};
+        for (uint32_t c = static_cast<uint32_t>(k + 1); c < node.skip; c = nodes_[c].skip) {
+            const Node & child = nodes_[c];
+            const Multipole & q = poles_[c];
+            const double m = child.mass;
+            const double dx = child.mx - node.mx;
+            const double dy = child.my - node.my;
+            p.qxx += q.qxx + m * dx * dx;
+            p.qxy += q.qxy + m * dx * dy;
+            p.qyy += q.qyy + m * dy * dy;
+            p.oxxx += q.oxxx + 3.0 * q.qxx * dx + m * dx * dx * dx;
+            p.oxxy += q.oxxy + q.qxx * dy + 2.0 * q.qxy * dx + m * dx * dx * dy;
+            p.oxyy += q.oxyy + 2.0 * q.qxy * dy + q.qyy * dx + m * dx * dy * dy;
+            p.oyyy += q.oyyy + 3.0 * q.qyy * dy + m * dy * dy * dy;
+        }
+        poles_[k] = p;
+    }
+    static void Moments(Node & node, const double & mass, const double & mx, const double & my) {
+        node.mass = mass;
+        if (mass > 0.0) {
+            node.mx = mx / mass;
+            node.my = my / mass;
+        } else {
+            node.mx = 0.0;
+            node.my = 0.0;
+        }
+    }
+    void ComputeGroups(Particles & bodies, const bool marked) {
+        const size_t live = nodes_.Empty() ? 0 : first_[nodes_.Size()];
+        for (size_t k = live; k < bodies.Size(); ++k) {
+            if (!marked || marked_[order_[k]] != 0) {
+                bodies.ax[order_[k]] = 0.0;
+                bodies.ay[order_[k]] = 0.0;
+            }
+        }
+
+        // Groups are the subtrees that first fit; the scan descends only
+        // through cells too big to be one.
+        groups_.Clear();
+        const uint32_t total = static_cast<uint32_t>(nodes_.Size());
+        for (uint32_t k = 0; k < total; ) {
+            const Node & node = nodes_[k];
+            if (first_[node.skip] - first_[k] <= group_size_ || node.skip == k + 1) {
+                groups_.PushBack(k);
+                k = node.skip;
+            } else {
+                ++k;
+            }
+        }
+
+        ThreadPool * pool = pool_.get();
+        while (lists_.size() < PoolThreads(pool)) {
+            lists_.emplace_back(new Lists);
+        }
+        ParallelFor(pool, 0, groups_.Size(), k_GroupGrain, [&](size_t begin, size_t end) {
+            Lists & lists = *lists_[PoolSlot(pool)];
+            uint64_t interactions = 0;
+            for (size_t g = begin; g < end; ++g) {
+                interactions += WalkGroup(bodies, groups_[g], marked, lists);
+            }
+            interactions_ += interactions;
+        });
+    }
+    uint64_t WalkGroup(Particles & bodies, const uint32_t group, const bool marked, Lists & l) {
+        l.tx.Clear();
+        l.ty.Clear();
+        l.target.Clear();
+        for (uint32_t b = first_[group]; b < first_[nodes_[group].skip]; ++b) {
+            if (!marked || marked_[order_[b]] != 0) {
+                l.tx.PushBack(sx_[b]);
+                l.ty.PushBack(sy_[b]);
+                l.target.PushBack(b);
+            }
+        }
+        const size_t count = l.target.Size();
+        if (count == 0) {
+            return 0;
+        }
+        double min_x = l.tx[0], max_x = l.tx[0];
+        double min_y = l.ty[0], max_y = l.ty[0];
+        for (size_t t = 1; t < count; ++t) {
+            min_x = std::min(min_x, l.tx[t]);
+            max_x = std::max(max_x, l.tx[t]);
+            min_y = std::min(min_y, l.ty[t]);
+            max_y = std::max(max_y, l.ty[t]);
+        }
+
+        l.x.Clear();
+        l.y.Clear();
+        l.m.Clear();
+        l.cells.Clear();
+        const Node * nodes = nodes_.Data();
+        const uint32_t total = static_cast<uint32_t>(nodes_.Size());
+        uint32_t k = 0;
+        while (k < total) {
+            const Node & node = nodes[k];
+            if (node.mass <= 0.0) {
+                k = node.skip;
+                continue;
+            }
+            if (node.skip == k + 1) {
+                for (uint32_t b = first_[k]; b < first_[k + 1]; ++b) {
+                    l.x.PushBack(sx_[b]);
+                    l.y.PushBack(sy_[b]);
+                    l.m.PushBack(sm_[b]);
+                }
+                k = node.skip;
+                continue;
+            }
+            const double dx = std::max(std::max(min_x - node.mx, node.mx - max_x), 0.0);
+            const double dy = std::max(std::max(min_y - node.my, node.my - max_y), 0.0);
+            if (dx * dx + dy * dy > node.open2) {
+                l.x.PushBack(node.mx);
+                l.y.PushBack(node.my);
+                l.m.PushBack(node.mass);
+                if (moments_ > moments__MONOPOLE) {
+                    l.cells.PushBack(k);
+                }
+                k = node.skip;
+            } else {
+                ++k;
+            }
+        }
+
+        // Every group member is among its own sources at zero separation,
+        // which the kernel skips.
+        l.tax.Resize(count);
+        l.tay.Resize(count);
+        const KernelTargets targets = { l.tx.Data(), l.ty.Data(), l.tax.Data(), l.tay.Data() };
+        const KernelSources sources = { l.x.Data(), l.y.Data(), l.m.Data(), l.x.Size() };
+        kernel_.Evaluate(targets, 0, count, sources, g_, eps2_);
+        if (!l.cells.Empty()) {
+            // Gathered once so the per-target passes stream through them.
+            const size_t cells = l.cells.Size();
+            l.cx.Resize(cells);
+            l.cy.Resize(cells);
+            l.poles.Resize(cells);
+            for (size_t c = 0; c < cells; ++c) {
+                l.cx[c] = nodes[l.cells[c]].mx;
+                l.cy[c] = nodes[l.cells[c]].my;
+                l.poles[c] = poles_[l.cells[c]];
+            }
+            for (size_t t = 0; t < count; ++t) {
+                for (size_t c = 0; c < cells; ++c) {
+                    AccumulatePoles(l.cx[c] - l.tx[t], l.cy[c] - l.ty[t], l.poles[c], l.tax[t], l.tay[t]);
+                }
+            }
+        }
+        for (size_t t = 0; t < count; ++t) {
+            const uint32_t i = order_[l.target[t]];
+            bodies.ax[i] = l.tax[t];
+            bodies.ay[i] = l.tay[t];
+        }
+        return static_cast<uint64_t>(count) * sources.count;
+    }
+    // Pairs at zero separation, the body itself included, contribute nothing.
+    // Returns the number of interactions.
+    uint64_t Walk(Particles & bodies, const size_t i) {
+        const double xi = bodies.x[i];
+        const double yi = bodies.y[i];
+        const Node * nodes = nodes_.Data();
+        const uint32_t total = static_cast<uint32_t>(nodes_.Size());
+        double axi = 0.0;
+        double ayi = 0.0;
+        uint64_t interactions = 0;
+
+        uint32_t k = 0;
+        while (k < total) {
+            const Node & node = nodes[k];
+            if (node.mass <= 0.0) {
+                k = node.skip;
+                continue;
+            }
+            const double dx = node.mx - xi;
+            const double dy = node.my - yi;
+            const double d2 = dx * dx + dy * dy;
+            if (node.skip == k + 1) {
+                const uint32_t count = first_[k + 1] - first_[k];
+                interactions += count;
+                if (count == 1) {
+                    if (d2 > 0.0) {
+                        Accumulate(dx, dy, node.mass, axi, ayi);
+                    }
+                } else {
+                    for (uint32_t b = first_[k]; b < first_[k + 1]; ++b) {
+                        const double bx = sx_[b] - xi;
+                        const double by = sy_[b] - yi;
+                        if (bx * bx + by * by > 0.0) {
+                            Accumulate(bx, by, sm_[b], axi, ayi);
+                        }
+                    }
+                }
+                k = node.skip;
+            } else if (d2 > node.open2) {
+                Accumulate(dx, dy, node.mass, axi, ayi);
+                if (moments_ > moments__MONOPOLE) {
+                    AccumulatePoles(dx, dy, poles_[k], axi, ayi);
+                }
+                ++interactions;
+                k = node.skip;
+            } else {
+                ++k;
+            }
+        }
+        bodies.ax[i] = axi;
+        bodies.ay[i] = ayi;
+        return interactions;
+    }
+    void Accumulate(const double & dx, const double & dy, const double & mass, double & ax, double & ay) const {
+        const double r2 = dx * dx + dy * dy + eps2_;
+        const double inv_r = 1.0 / sqrt(r2);
+        const double f = g_ * mass * inv_r * inv_r * inv_r;
+        ax += f * dx;
+        ay += f * dy;
+    }
+    // Higher terms of the expansion of 1/|r - s| about the centre of mass,
+    // with r the target relative to it (r = -(dx, dy)), softened like the
+    // monopole. Masses sit in the plane, so the traces run over x and y only.
+    void AccumulatePoles(const double & dx, const double & dy, const Multipole & p, double & ax, double & ay) const {
+        const double rx = -dx;
+        const double ry = -dy;
+        const double inv_r2 = 1.0 / (dx * dx + dy * dy + eps2_);
+        const double inv_r = sqrt(inv_r2);
+        const double inv_r5 = inv_r * inv_r2 * inv_r2;
+        const double inv_r7 = inv_r5 * inv_r2;
+
+        // a2 = 3 Q r / r^5 - 15/2 (r.Q.r) r / r^7 + 3/2 tr(Q) r / r^5
+        const double qrx = p.qxx * rx + p.qxy * ry;
+        const double qry = p.qxy * rx + p.qyy * ry;
+        const double rqr = rx * qrx + ry * qry;
+        const double tr = p.qxx + p.qyy;
+        double fx = 3.0 * qrx * inv_r5 + (1.5 * tr * inv_r5 - 7.5 * rqr * inv_r7) * rx;
+        double fy = 3.0 * qry * inv_r5 + (1.5 * tr * inv_r5 - 7.5 * rqr * inv_r7) * ry;
+
+        if (moments_ >= moments__OCTUPOLE) {
+            // a3 = (45 B / r^7 - 105 C r / r^9 - 9 v / r^5 + 45 (v.r) r / r^7) / 6
+            // with B_i = O_ijk r_j r_k, C = r.B and v_i = O_ijj.
+            const double bx = p.oxxx * rx * rx + 2.0 * p.oxxy * rx * ry + p.oxyy * ry * ry;
+            const double by = p.oxxy * rx * rx + 2.0 * p.oxyy * rx * ry + p.oyyy * ry * ry;
+            const double c = rx * bx + ry * by;
+            const double vx = p.oxxx + p.oxyy;
+            const double vy = p.oxxy + p.oyyy;
+            const double vr = vx * rx + vy * ry;
+            const double radial = (45.0 * vr * inv_r7 - 105.0 * c * inv_r7 * inv_r2) / 6.0;
+            fx += (45.0 * bx * inv_r7 - 9.0 * vx * inv_r5) / 6.0 + radial * rx;
+            fy += (45.0 * by * inv_r7 - 9.0 * vy * inv_r5) / 6.0 + radial * ry;
+        }
+        ax += g_ * fx;
+        ay += g_ * fy;
+    }
+};
+
+#endif // BARNES_HUT_ENGINE_HPP
@@ -0,0 +1,365 @@
+#ifndef BATCH_HPP
+#define BATCH_HPP
+
+#include "CustomException.hpp"
+#include "Logger.hpp"
+#include "Simulation.hpp"
+
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <cerrno>
+#include <cfloat>
+#include <climits>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+
+// Headless front-end: steps a Simulation as fast as the CPU allows and writes
+// snapshots to a CSV file. It drives the same Simulation code with the same
+// default time step as the interactive build, so matching settings give
+// matching trajectories.
+class Batch {
+private:
+    enum {
+        // Sanity bound on --threads; each worker owns a queue.
+        k_MaxThreads = 1024,
+    };
+
+    std::shared_ptr<Simulation> sim_;
+    std::shared_ptr<Ensemble> ensemble_;
+    SimSettings settings_;
+    int scene_;
+    int bodies_;
+    int members_;
+    int scheme_;
+    double dt_;
+    uint64_t steps_;
+    uint64_t every_;
+    size_t threads_;
+    bool pin_;
+    bool accuracy_;
+    std::string output_;
+    FILE * out_;
+
+public:
+    Batch()
+    : scene_(Simulation::scene__SOLAR)
+    , bodies_(10000)
+    , members_(0)
+    , scheme_(Ensemble::scheme__LEAPFROG)
+    , dt_(Simulation::DefaultTimeStep())
+    , steps_(100000)
+    , every_(1000)
+    , threads_(0)
+    , pin_(false)
+    , accuracy_(false)
+    , output_("gravsim.csv")
+    , out_(nullptr)
+    {}
+    ~Batch() {
+        Quit();
+    }
+    void Init(int argc, char ** argv) {
+        ParseArguments(argc, argv);
+
+        sim_ = std::make_shared<Simulation>();
+        sim_->Init(threads_, pin_);
+        if (settings_.theta < 0.0) {
+            settings_.theta = sim_->DefaultTheta();
+        }
+        if (settings_.engine < 0 || settings_.engine >= static_cast<int>(sim_->EngineNames().size())) {
+            throw CustomException("No such engine [%d]!", settings_.engine);
+        }
+        if (settings_.integrator < 0 || settings_.integrator >= static_cast<int>(sim_->IntegratorNames().size())) {
+            throw CustomException("No such integrator [%d]!", settings_.integrator);
+        }
+        if (settings_.order < FmmEngine::k_MinOrder || settings_.order > FmmEngine::k_MaxOrder) {
+            throw CustomException("No such expansion order [%d]!", settings_.order);
+        }
+        if (settings_.mesh < PmEngine::k_MinMesh || settings_.mesh > PmEngine::k_MaxMesh || (settings_.mesh & (settings_.mesh - 1)) != 0) {
+            throw CustomException("Mesh size [%d] is not a power of two in range!", settings_.mesh);
+        }
+        if (!(settings_.tolerance > 0.0)) {
+            throw CustomException("Tolerance [%g] must be positive!", settings_.tolerance);
+        }
+        sim_->Configure(settings_);
+        sim_->Reset(scene_, bodies_);
+        if (accuracy_) {
+            // Reports go to stdout; leave earlier results in the output alone.
+            return;
+        }
+
+        out_ = fopen(output_.c_str(), "wt");
+        if (out_ == nullptr) {
+            throw CustomException("Unable to open output file [%s]!", output_.c_str());
+        }
+        if (members_ > 0) {
+            ensemble_ = std::make_shared<Ensemble>();
+            ensemble_->SetScheme(scheme_);
+            sim_->InitEnsemble(*ensemble_, static_cast<size_t>(members_));
+            fprintf(out_, "member,stop,days,steps,body,x,y,vx,vy,m\n");
+            L_INFO("Batch: ensemble of %zu x %zu bodies, %s, dt %g, %llu steps -> %s"
+                , ensemble_->Members()
+                , ensemble_->Bodies()
+                , Ensemble::SchemeName(scheme_)
+                , dt_
+                , static_cast<unsigned long long>(steps_)
+                , output_.c_str()
+            );
+            return;
+        }
+        fprintf(out_, "step,days,id,x,y,vx,vy,m\n");
+
+        const auto engines = sim_->EngineNames();
+        const auto integrators = sim_->IntegratorNames();
+        L_INFO("Batch: %zu bodies, %zu tracers, %s, %s, dt %g, %llu steps -> %s"
+            , sim_->Bodies().Alive()
+            , sim_->TestParticles().Size()
+            , engines[settings_.engine].c_str()
+            , integrators[settings_.integrator].c_str()
+            , dt_
+            , static_cast<unsigned long long>(steps_)
+            , output_.c_str()
+        );
+    }
+    void Run() {
+        if (accuracy_) {
+            sim_->ReportTreeAccuracy(stdout);
+            sim_->ReportFmmAccuracy(stdout);
+            sim_->ReportMeshAccuracy(stdout);
+            return;
+        }
+        if (ensemble_) {
+            RunEnsemble();
+            return;
+        }
+        Diagnostics d0, d;
+        double error = 0.0;
+        const bool diagnosed = sim_->Diagnose(d0, error);
+
+        const auto start = std::chrono::steady_clock::now();
+        WriteSnapshot();
+        for (uint64_t s = 1; s <= steps_; ++s) {
+            sim_->Step(dt_);
+            if (every_ > 0 && s % every_ == 0) {
+                WriteSnapshot();
+            }
+        }
+        const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        L_INFO("Batch: %.1f days in %.2f s, %.0f steps/s."
+            , sim_->Elapsed()
+            , seconds
+            , seconds > 0.0 ? steps_ / seconds : 0.0
+        );
+        if (diagnosed && sim_->Diagnose(d, error)) {
+            L_INFO("Batch: relative energy error %.3e.", error);
+        }
+    }
+    void Quit() {
+        if (out_ != nullptr) {
+            fclose(out_);
+            out_ = nullptr;
+        }
+    }
+
+private:
+    // Runs every member to the end or to its stop condition, then writes
+    // each member's outcome and final bodies.
+    void RunEnsemble() {
+        const auto start = std::chrono::steady_clock::now();
+        ensemble_->Run(dt_, steps_);
+        const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        uint64_t member_steps = 0;
+        size_t stopped[3] = { 0, 0, 0 };
+        for (const auto & r : ensemble_->Results()) {
+            member_steps += r.steps;
+            ++stopped[r.stop];
+            for (size_t b = 0; b < ensemble_->Bodies(); ++b) {
+                double x, y, vx, vy, m;
+                ensemble_->Get(r.member, b, x, y, vx, vy, m);
+                fprintf(out_, "%u,%s,%.17g,%llu,%zu,%.17g,%.17g,%.17g,%.17g,%.17g\n"
+                    , r.member
+                    , Ensemble::StopName(r.stop)
+                    , sim_->StepDays(r.time)
+                    , static_cast<unsigned long long>(r.steps)
+                    , b
+                    , x
+                    , y
+                    , vx
+                    , vy
+                    , m
+                );
+            }
+        }
+        L_INFO("Batch: %zu running, %zu escaped, %zu encounters; %llu member steps in %.2f s, %.3g per second."
+            , stopped[Ensemble::stop__RUNNING]
+            , stopped[Ensemble::stop__ESCAPE]
+            , stopped[Ensemble::stop__ENCOUNTER]
+            , static_cast<unsigned long long>(member_steps)
+            , seconds
+            , seconds > 0.0 ? member_steps / seconds : 0.0
+        );
+    }
+    void WriteSnapshot() {
+        const Particles & b = sim_->Bodies();
+        const unsigned long long step = sim_->Steps();
+        // In id order, whatever the storage order is at the moment.
+        for (uint32_t id = 0; id < b.NextId(); ++id) {
+            const size_t i = b.Find(id);
+            if (i >= b.Size()) {
+                continue;
+            }
+            // %.17g round-trips doubles exactly.
+            fprintf(out_, "%llu,%.17g,%u,%.17g,%.17g,%.17g,%.17g,%.17g\n"
+                , step
+                , sim_->Elapsed()
+                , b.id[i]
+                , b.x[i]
+                , b.y[i]
+                , b.vx[i]
+                , b.vy[i]
+                , b.m[i]
+            );
+        }
+        // Tracers follow with ids numbered on from the bodies and no mass.
+        const Tracers & t = sim_->TestParticles();
+        for (size_t i = 0; i < t.Size(); ++i) {
+            fprintf(out_, "%llu,%.17g,%zu,%.17g,%.17g,%.17g,%.17g,0\n"
+                , step
+                , sim_->Elapsed()
+                , b.NextId() + i
+                , t.x[i]
+                , t.y[i]
+                , t.vx[i]
+                , t.vy[i]
+            );
+        }
+    }
+    void ParseArguments(int argc, char ** argv) {
+        settings_.theta = -1.0;
+        for (int i = 1; i < argc; ++i) {
+            const std::string arg(argv[i]);
+            if (arg == "-h" || arg == "--help") {
+                Usage();
+                exit(0);
+            }
+            if (i + 1 >= argc) {
+                throw CustomException("Missing value for [%s]!", arg.c_str());
+            }
+            const std::string value(argv[++i]);
+            if (arg == "--scene") {
+                if (value == "solar") {
+                    scene_ = Simulation::scene__SOLAR;
+                } else if (value == "disk") {
+                    scene_ = Simulation::scene__DISK;
+                } else if (value == "belt") {
+                    scene_ = Simulation::scene__BELT;
+                } else {
+                    throw CustomException("Unknown scene [%s]!", value.c_str());
+                }
+            } else if (arg == "--bodies") {
+                bodies_ = static_cast<int>(ParseInteger(arg, value, 0, INT_MAX));
+            } else if (arg == "--engine") {
+                settings_.engine = static_cast<int>(ParseInteger(arg, value, 0, INT_MAX));
+            } else if (arg == "--integrator") {
+                settings_.integrator = static_cast<int>(ParseInteger(arg, value, 0, INT_MAX));
+            } else if (arg == "--theta") {
+                settings_.theta = ParseReal(arg, value, 0.0, HUGE_VAL);
+            } else if (arg == "--moments") {
+                settings_.moments = static_cast<int>(ParseInteger(arg, value, BarnesHutEngine::moments__MONOPOLE, BarnesHutEngine::moments__OCTUPOLE));
+            } else if (arg == "--group") {
+                settings_.group = static_cast<int>(ParseInteger(arg, value, 0, INT_MAX));
+            } else if (arg == "--order") {
+                settings_.order = static_cast<int>(ParseInteger(arg, value, FmmEngine::k_MinOrder, FmmEngine::k_MaxOrder));
+            } else if (arg == "--mesh") {
+                settings_.mesh = static_cast<int>(ParseInteger(arg, value, PmEngine::k_MinMesh, PmEngine::k_MaxMesh));
+            } else if (arg == "--tolerance") {
+                settings_.tolerance = ParseReal(arg, value, DBL_MIN, HUGE_VAL);
+            } else if (arg == "--ensemble") {
+                members_ = static_cast<int>(ParseInteger(arg, value, 0, INT_MAX));
+            } else if (arg == "--scheme") {
+                scheme_ = static_cast<int>(ParseInteger(arg, value, Ensemble::scheme__EULER, Ensemble::scheme__YOSHIDA6));
+            } else if (arg == "--dt") {
+                dt_ = ParseReal(arg, value, -HUGE_VAL, HUGE_VAL);
+            } else if (arg == "--steps") {
+                steps_ = static_cast<uint64_t>(ParseInteger(arg, value, 0, LLONG_MAX));
+            } else if (arg == "--every") {
+                every_ = static_cast<uint64_t>(ParseInteger(arg, value, 0, LLONG_MAX));
+            } else if (arg == "--threads") {
+                threads_ = static_cast<size_t>(ParseInteger(arg, value, 0, k_MaxThreads));
+            } else if (arg == "--pin") {
+                pin_ = ParseInteger(arg, value, 0, 1) != 0;
+            } else if (arg == "--accuracy") {
+                accuracy_ = ParseInteger(arg, value, 0, 1) != 0;
+            } else if (arg == "--output") {
+                output_ = value;
+            } else {
+                throw CustomException("Unknown argument [%s]!", arg.c_str());
+            }
+        }
+    }
+    // Whole-string integer in [min, max].
+    static long long ParseInteger(const std::string & arg, const std::string & value, const long long min, const long long max) {
+        char * end = nullptr;
+        errno = 0;
+        const long long v = strtoll(value.c_str(), &end, 10);
+        if (value.empty() || *end != '\0' || errno == ERANGE || v < min || v > max) {
+            throw CustomException("Bad value [%s] for %s!", value.c_str(), arg.c_str());
+        }
+        return v;
+    }
+    // Whole-string finite real in [min, max].
+    static double ParseReal(const std::string & arg, const std::string & value, const double min, const double max) {
+        char * end = nullptr;
+        errno = 0;
+        const double v = strtod(value.c_str(), &end);
+        if (value.empty() || *end != '\0' || errno == ERANGE || !std::isfinite(v) || v < min || v > max) {
+            throw CustomException("Bad value [%s] for %s!", value.c_str(), arg.c_str());
+        }
+        return v;
+    }
+    void Usage() {
+        Simulation sim;
+        sim.Init(1);
+        printf("usage: gravSimBatch [options]\n");
+        printf("  --scene NAME         initial conditions: solar, disk or belt (solar)\n");
+        printf("  --bodies N           disk bodies or belt tracers (10000)\n");
+        printf("  --engine N           force engine (0)\n");
+        PrintNames(sim.EngineNames());
+        printf("  --integrator N       integrator (0)\n");
+        PrintNames(sim.IntegratorNames());
+        printf("  --theta T            Barnes-Hut opening angle (%g)\n", sim.DefaultTheta());
+        printf("  --moments N          Barnes-Hut cell moments (0)\n");
+        for (int m = BarnesHutEngine::moments__MONOPOLE; m <= BarnesHutEngine::moments__OCTUPOLE; ++m) {
+            printf("                         %d: %s\n", m, BarnesHutEngine::MomentsName(m));
+        }
+        printf("  --group N            Barnes-Hut bodies per shared walk, 0 for one walk per body (64)\n");
+        printf("  --order N            FMM expansion order, %d to %d (6)\n", FmmEngine::k_MinOrder, FmmEngine::k_MaxOrder);
+        printf("  --mesh N             particle-mesh and P3M nodes per side, power of two %d to %d (256)\n", PmEngine::k_MinMesh, PmEngine::k_MaxMesh);
+        printf("  --tolerance T        adaptive integrators' error per step (1e-09)\n");
+        printf("  --ensemble N         run N Sun-Earth variants side by side instead of a scene, 0 for off (0)\n");
+        printf("  --scheme N           ensemble integrator (%d)\n", Ensemble::scheme__LEAPFROG);
+        for (int s = Ensemble::scheme__EULER; s <= Ensemble::scheme__YOSHIDA6; ++s) {
+            printf("                         %d: %s\n", s, Ensemble::SchemeName(s));
+        }
+        printf("  --dt DT              time step (%g)\n", Simulation::DefaultTimeStep());
+        printf("  --steps N            steps to run (100000)\n");
+        printf("  --every N            snapshot interval in steps, 0 for first only (1000)\n");
+        printf("  --threads N          worker threads, 0 for all cores (0)\n");
+        printf("  --pin 0|1            pin workers to cores (0)\n");
+        printf("  --output FILE        CSV output (gravsim.csv)\n");
+        printf("  --accuracy 0|1       print tree, FMM and mesh accuracy against direct summation and exit (0)\n");
+    }
+    void PrintNames(const std::vector<std::string> & names) {
+        for (size_t i = 0; i < names.size(); ++i) {
+            printf("                         %zu: %s\n", i, names[i].c_str());
+        }
+    }
+};
+
+#endif // BATCH_HPP
@@ -0,0 +1,238 @@
+#ifndef BLOCK_STEP_INTEGRATOR_HPP
+#define BLOCK_STEP_INTEGRATOR_HPP
+
+#include "AlignedArray.hpp"
+#include "Integrator.hpp"
+#include "Logger.hpp"
+
+#include <cmath>
+#include <cstdint>
+
+// Hierarchical (power-of-two) block time steps around kick-drift-kick
+// leapfrog. Body i runs at level L_i with step dt / 2^L_i, so a close pair can
+// take thousands of substeps while the rest of the system takes one. Every
+// substep drifts all bodies but only evaluates forces on the bodies whose own
+// step ends there, through ForceEngine::ComputeActive().
+//
+// Levels follow the jerk criterion dt_i = eta |a| / |da/dt|, with the jerk
+// taken from the change of acceleration over the body's last step. A body may
+// move to a finer level at any of its step boundaries but to a coarser one
+// only one level at a time and only where the coarser grid is aligned, which
+// keeps every body synchronised at the end of each Step().
+class BlockStepIntegrator : public Integrator {
+private:
+    enum {
+        // 2^20 substeps per step is far below the point where drifts lose
+        // precision against the step.
+        k_MaxLevel = 20,
+    };
+    typedef uint32_t Tick;
+    static const Tick k_Ticks = Tick(1) << k_MaxLevel;
+
+    double eta_;
+    AlignedArray<uint8_t> level_;
+    AlignedArray<uint32_t> active_;
+    AlignedArray<double> ox_, oy_, oax_, oay_;  // scratch: saved state
+    size_t occupied_[k_MaxLevel + 1];
+    uint64_t evaluations_;
+    uint64_t substeps_;
+    bool warned_;
+
+public:
+    BlockStepIntegrator()
+    : eta_(0.02)
+    , evaluations_(0)
+    , substeps_(0)
+    , warned_(false)
+    {}
+    ~BlockStepIntegrator() {}
+    const char * Name() const override {
+        return "Leapfrog (block steps)";
+    }
+    // Accuracy parameter of the step criterion; smaller is finer.
+    void SetEta(const double & eta) {
+        eta_ = eta;
+    }
+    double GetEta() const {
+        return eta_;
+    }
+    // Single-body force evaluations and substeps since construction. With
+    // shared steps every substep would have cost Size() evaluations.
+    uint64_t Evaluations() const {
+        return evaluations_;
+    }
+    uint64_t Substeps() const {
+        return substeps_;
+    }
+    void Permute(const uint32_t * order, const size_t count) override {
+        if (level_.Size() != count) {
+            valid_ = false;
+            return;
+        }
+        AlignedArray<uint8_t> level;
+        level.Resize(count);
+        for (size_t k = 0; k < count; ++k) {
+            level[k] = level_[order[k]];
+        }
+        level_.Swap(level);
+    }
+    void Step(Particles & bodies, ForceEngine & engine, const double & dt) override {
+        const size_t n = bodies.Size();
+        if (n == 0) {
+            return;
+        }
+        if (!valid_ || level_.Size() != n) {
+            Start(bodies, engine, dt);
+        }
+
+        const double tick = dt / k_Ticks;
+        // Everybody starts a step at t = 0.
+        for (size_t i = 0; i < n; ++i) {
+            const double h = 0.5 * dt / (Tick(1) << level_[i]);
+            bodies.vx[i] += bodies.ax[i] * h;
+            bodies.vy[i] += bodies.ay[i] * h;
+        }
+
+        Tick t = 0;
+        while (t < k_Ticks) {
+            const Tick next = t + (k_Ticks >> Finest());
+            Drift(bodies, (next - t) * tick);
+            t = next;
+            ++substeps_;
+
+            // Bodies whose step ends now.
+            active_.Clear();
+            for (size_t i = 0; i < n; ++i) {
+                if ((t & ((k_Ticks >> level_[i]) - 1)) == 0) {
+                    active_.PushBack(static_cast<uint32_t>(i));
+                }
+            }
+            const size_t count = active_.Size();
+            oax_.Resize(count);
+            oay_.Resize(count);
+            for (size_t k = 0; k < count; ++k) {
+                oax_[k] = bodies.ax[active_[k]];
+                oay_[k] = bodies.ay[active_[k]];
+            }
+            engine.ComputeActive(bodies, active_.Data(), count);
+            evaluations_ += count;
+
+            for (size_t k = 0; k < count; ++k) {
+                const size_t i = active_[k];
+                const double h = dt / (Tick(1) << level_[i]);
+                // Closing half kick of the step just finished.
+                bodies.vx[i] += bodies.ax[i] * 0.5 * h;
+                bodies.vy[i] += bodies.ay[i] * 0.5 * h;
+
+                const double jx = (bodies.ax[i] - oax_[k]) / h;
+                const double jy = (bodies.ay[i] - oay_[k]) / h;
+                const int wanted = Level(bodies.ax[i], bodies.ay[i], jx, jy, dt);
+                int level = level_[i];
+                if (wanted > level) {
+                    level = wanted;
+                } else if (wanted < level && (t & ((k_Ticks >> (level - 1)) - 1)) == 0) {
+                    --level;
+                }
+                Move(i, level);
+
+                if (t < k_Ticks) {
+                    // Opening half kick of the next one.
+                    const double hn = 0.5 * dt / (Tick(1) << level_[i]);
+                    bodies.vx[i] += bodies.ax[i] * hn;
+                    bodies.vy[i] += bodies.ay[i] * hn;
+                }
+            }
+        }
+        // All bodies were active at t == k_Ticks, so every acceleration is
+        // current for the next step's opening kick.
+    }
+
+private:
+    // Fresh accelerations plus a first jerk estimate from a tiny trial drift,
+    // which sets the initial levels without a special-case criterion.
+    void Start(Particles & bodies, ForceEngine & engine, const double & dt) {
+        const size_t n = bodies.Size();
+        level_.Resize(n);
+        level_.Fill(0);
+        for (int l = 0; l <= k_MaxLevel; ++l) {
+            occupied_[l] = 0;
+        }
+        occupied_[0] = n;
+
+        engine.Compute(bodies);
+        ox_.Resize(n);
+        oy_.Resize(n);
+        oax_.Resize(n);
+        oay_.Resize(n);
+        for (size_t i = 0; i < n; ++i) {
+            ox_[i] = bodies.x[i];
+            oy_[i] = bodies.y[i];
+            oax_[i] = bodies.ax[i];
+            oay_[i] = bodies.ay[i];
+        }
+        const double h = dt / k_Ticks;
+        Drift(bodies, h);
+        engine.Compute(bodies);
+        evaluations_ += 2 * n;
+        for (size_t i = 0; i < n; ++i) {
+            const double jx = (bodies.ax[i] - oax_[i]) / h;
+            const double jy = (bodies.ay[i] - oay_[i]) / h;
+            bodies.x[i] = ox_[i];
+            bodies.y[i] = oy_[i];
+            bodies.ax[i] = oax_[i];
+            bodies.ay[i] = oay_[i];
+            Move(i, Level(oax_[i], oay_[i], jx, jy, dt));
+        }
+        valid_ = true;
+    }
+    // Finest level whose step still satisfies dt_i <= eta |a| / |j|.
+    int Level(const double & ax, const double & ay, const double & jx, const double & jy, const double & dt) {
+        const double a = sqrt(ax * ax + ay * ay);
+        const double j = sqrt(jx * jx + jy * jy);
+        if (!(j > 0.0)) {
+            return 0;
+        }
+        const double wanted = eta_ * a / j;
+        if (!(wanted > 0.0)) {
+            return k_MaxLevel;
+        }
+        int level = 0;
+        double h = dt;
+        while (h > wanted && level < k_MaxLevel) {
+            h *= 0.5;
+            ++level;
+        }
+        if (h > wanted && !warned_) {
+            L_WARN("BlockStepIntegrator: a body needs a step below dt / 2^%d.", static_cast<int>(k_MaxLevel));
+            warned_ = true;
+        }
+        return level;
+    }
+    void Move(const size_t i, const int level) {
+        --occupied_[level_[i]];
+        ++occupied_[level];
+        level_[i] = static_cast<uint8_t>(level);
+    }
+    int Finest() const {
+        for (int l = k_MaxLevel; l > 0; --l) {
+            if (occupied_[l] > 0) {
+                return l;
+            }
+        }
+        return 0;
+    }
+    void Drift(Particles & bodies, const double & h) {
+        double * x = bodies.x.Data();
+        double * y = bodies.y.Data();
+        const double * vx = bodies.vx.Data();
+        const double * vy = bodies.vy.Data();
+        ParallelFor(pool_.get(), 0, bodies.Size(), k_StreamGrain, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; ++i) {
+                x[i] += vx[i] * h;
+                y[i] += vy[i] * h;
+            }
+        });
+    }
+};
+
+#endif // BLOCK_STEP_INTEGRATOR_HPP
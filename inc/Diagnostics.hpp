@@ -0,0 +1,65 @@
+#ifndef DIAGNOSTICS_HPP
+#define DIAGNOSTICS_HPP
+
+#include "AlignedArray.hpp"
+#include "Particles.hpp"
+#include "ThreadPool.hpp"
+
+#include <cmath>
+
+// Conserved quantities of the whole system, for monitoring integration error.
+struct Diagnostics {
+    double kinetic = 0.0;
+    double potential = 0.0;
+    double px = 0.0;
+    double py = 0.0;
+
+    double Energy() const {
+        return kinetic + potential;
+    }
+};
+
+// Exact O(N^2) evaluation split over the pool. Per-body partial sums land in
+// scratch and are added up in index order, so the result does not depend on
+// how the work was scheduled.
+inline Diagnostics Diagnose(
+    const Particles & bodies,
+    const double & g,
+    const double & eps2,
+    ThreadPool * pool,
+    AlignedArray<double> & scratch
+) {
+    enum { k_Grain = 64 };
+
+    const size_t n = bodies.Size();
+    const double * x = bodies.x.Data();
+    const double * y = bodies.y.Data();
+    const double * m = bodies.m.Data();
+    scratch.Resize(n);
+    double * phi = scratch.Data();
+
+    ParallelFor(pool, 0, n, k_Grain, [=](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            double sum = 0.0;
+            for (size_t j = i + 1; j < n; ++j) {
+                const double dx = x[j] - x[i];
+                const double dy = y[j] - y[i];
+                sum += m[j] / sqrt(dx * dx + dy * dy + eps2);
+            }
+            phi[i] = -g * m[i] * sum;
+        }
+    });
+
+    Diagnostics d;
+    for (size_t i = 0; i < n; ++i) {
+        const double vx = bodies.vx[i];
+        const double vy = bodies.vy[i];
+        d.kinetic += 0.5 * m[i] * (vx * vx + vy * vy);
+        d.potential += phi[i];
+        d.px += m[i] * vx;
+        d.py += m[i] * vy;
+    }
+    return d;
+}
+
+#endif // DIAGNOSTICS_HPP
@@ -0,0 +1,81 @@
+#ifndef DIRECT_ENGINE_HPP
+#define DIRECT_ENGINE_HPP
+
+#include "ForceEngine.hpp"
+
+#include <cmath>
+
+// Exact all-pairs summation, O(N^2). Each pair is visited once and applied
+// to both bodies. This is the accuracy reference for the other engines and
+// deliberately stays serial so its rounding never depends on the pool.
+class DirectEngine : public ForceEngine {
+public:
+    DirectEngine() {}
+    ~DirectEngine() {}
+    const char * Name() const override {
+        return "Direct";
+    }
+    void Compute(Particles & bodies) override {
+        bodies.ClearAccelerations();
+
+        const size_t n = bodies.Size();
+        const double * x = bodies.x.Data();
+        const double * y = bodies.y.Data();
+        const double * m = bodies.m.Data();
+        double * ax = bodies.ax.Data();
+        double * ay = bodies.ay.Data();
+        for (size_t i = 0; i < n; ++i) {
+            const double xi = x[i];
+            const double yi = y[i];
+            const double gmi = g_ * m[i];
+            double axi = 0.0;
+            double ayi = 0.0;
+            for (size_t j = i + 1; j < n; ++j) {
+                const double dx = x[j] - xi;
+                const double dy = y[j] - yi;
+                const double r2 = dx * dx + dy * dy + eps2_;
+                const double r = sqrt(r2);
+                const double inv_r3 = 1.0 / (r2 * r);
+                const double gmj = g_ * m[j];
+                axi += gmj * dx * inv_r3;
+                ayi += gmj * dy * inv_r3;
+                ax[j] -= gmi * dx * inv_r3;
+                ay[j] -= gmi * dy * inv_r3;
+            }
+            ax[i] += axi;
+            ay[i] += ayi;
+        }
+    }
+    // Pair symmetry does not help when only a few targets are wanted, so
+    // each one sums over every source, in index order.
+    void ComputeActive(Particles & bodies, const uint32_t * active, const size_t count) override {
+        const size_t n = bodies.Size();
+        const double * x = bodies.x.Data();
+        const double * y = bodies.y.Data();
+        const double * m = bodies.m.Data();
+        for (size_t k = 0; k < count; ++k) {
+            const size_t i = active[k];
+            const double xi = x[i];
+            const double yi = y[i];
+            double axi = 0.0;
+            double ayi = 0.0;
+            for (size_t j = 0; j < n; ++j) {
+                if (j == i) {
+                    continue;
+                }
+                const double dx = x[j] - xi;
+                const double dy = y[j] - yi;
+                const double r2 = dx * dx + dy * dy + eps2_;
+                const double r = sqrt(r2);
+                const double inv_r3 = 1.0 / (r2 * r);
+                const double gmj = g_ * m[j];
+                axi += gmj * dx * inv_r3;
+                ayi += gmj * dy * inv_r3;
+            }
+            bodies.ax[i] = axi;
+            bodies.ay[i] = ayi;
+        }
+    }
+};
+
+#endif // DIRECT_ENGINE_HPP
@@ -0,0 +1,477 @@
+#ifndef ENSEMBLE_HPP
+#define ENSEMBLE_HPP
+
+#include "AlignedArray.hpp"
+#include "CustomException.hpp"
+#include "GravityKernel.hpp"
+#include "Integrator.hpp"
+#include "ThreadPool.hpp"
+
+#include <algorithm>
+#include <limits>
+#include <memory>
+#include <vector>
+
+#include <cmath>
+#include <cstdint>
+
+// The block step is compiled once per instruction set so its lane loops are
+// vectorised at full width; its helpers must be inlined into each copy.
+#ifdef GRAV_SIMD_X86
+#define ENSEMBLE_INLINE __attribute__((always_inline)) inline
+#else
+#define ENSEMBLE_INLINE inline
+#endif
+
+// Many independent copies of one small system, e.g. a parameter sweep over
+// initial conditions, advanced together in one process. Every member has
+// the same number of bodies; body b of member k lives at b * stride + k, so
+// each body's members are contiguous and one SIMD lane holds one member.
+// Pair forces are summed across 4 or 8 members at a time with the
+// instruction set picked by GravityKernel::Detect(), scalar otherwise.
+//
+// Members are grouped in blocks of k_Block lanes and each block runs all of
+// its steps on one pool worker without synchronising with the others, so
+// there is no per-step hand-off however small the systems are. Every member
+// follows the same arithmetic whichever block or thread it lands in.
+//
+// A member stops early when a body escapes past the escape radius from the
+// member's barycentre or when two of its bodies come within the encounter
+// distance at a force evaluation. Stopped members keep their final state and
+// are skipped by the kicks and drifts; a block quits once all of its members
+// have stopped.
+class Ensemble {
+public:
+    enum {
+        stop__RUNNING = 0,
+        stop__ESCAPE,
+        stop__ENCOUNTER,
+    };
+    enum {
+        scheme__EULER = 0,
+        scheme__LEAPFROG,
+        scheme__YOSHIDA4,
+        scheme__YOSHIDA6,
+    };
+
+    // Outcome of one member.
+    struct Result {
+        uint32_t member;
+        int stop;
+        double time;
+        uint64_t steps;
+    };
+
+private:
+    enum {
+        // Members per block: a multiple of every SIMD width, and small
+        // enough that a few-body block stays in L1.
+        k_Block = 64,
+        k_MaxStages = 8,
+    };
+
+    size_t bodies_;
+    size_t members_;
+    size_t stride_;                  // members_ rounded up to k_Block
+    AlignedArray<double> x_, y_;
+    AlignedArray<double> vx_, vy_;
+    AlignedArray<double> ax_, ay_;
+    AlignedArray<double> m_;
+    AlignedArray<double> near_;      // closest pair r^2 at the last evaluation
+    AlignedArray<double> live_;      // 1 while running, 0 once stopped
+    AlignedArray<uint8_t> stop_;
+    AlignedArray<double> time_;
+    AlignedArray<uint64_t> steps_;
+
+    double g_;
+    double eps2_;
+    double escape2_;
+    double encounter2_;
+    int scheme_;
+    int stages_;
+    double kick_[k_MaxStages];
+    double drift_[k_MaxStages];
+    int isa_;
+    std::shared_ptr<ThreadPool> pool_;
+
+public:
+    Ensemble()
+    : bodies_(0), members_(0), stride_(0)
+    , g_(1.0), eps2_(0.0), escape2_(0.0), encounter2_(0.0)
+    , scheme_(-1), stages_(0)
+    , isa_(GravityKernel::Detect())
+    {
+        SetScheme(scheme__LEAPFROG);
+    }
+    ~Ensemble() {}
+    // Room for `members` systems of `bodies` bodies each, all at rest at the
+    // origin with no mass until Set() fills them in.
+    void Init(const size_t bodies, const size_t members) {
+        if (bodies == 0 || members == 0) {
+            throw CustomException("Ensemble needs bodies and members, got [%zu] x [%zu]!", bodies, members);
+        }
+        bodies_ = bodies;
+        members_ = members;
+        stride_ = (members + k_Block - 1) / k_Block * k_Block;
+        const size_t n = bodies_ * stride_;
+        for (auto * a : { &x_, &y_, &vx_, &vy_, &ax_, &ay_, &m_ }) {
+            a->Resize(n);
+            a->Fill(0.0);
+        }
+        near_.Resize(stride_);
+        live_.Resize(stride_);
+        stop_.Resize(stride_);
+        time_.Resize(stride_);
+        steps_.Resize(stride_);
+        // Padding lanes past the last member never run.
+        for (size_t k = 0; k < stride_; ++k) {
+            live_[k] = k < members_ ? 1.0 : 0.0;
+            stop_[k] = stop__RUNNING;
+            time_[k] = 0.0;
+            steps_[k] = 0;
+        }
+    }
+    void Set(
+        const size_t member, const size_t body,
+        const double & px, const double & py,
+        const double & pvx, const double & pvy,
+        const double & mass
+    ) {
+        const size_t i = body * stride_ + member;
+        x_[i] = px;
+        y_[i] = py;
+        vx_[i] = pvx;
+        vy_[i] = pvy;
+        m_[i] = mass;
+    }
+    void Get(
+        const size_t member, const size_t body,
+        double & px, double & py, double & pvx, double & pvy, double & mass
+    ) const {
+        const size_t i = body * stride_ + member;
+        px = x_[i];
+        py = y_[i];
+        pvx = vx_[i];
+        pvy = vy_[i];
+        mass = m_[i];
+    }
+    void SetGravitationalConstant(const double & g) {
+        g_ = g;
+    }
+    void SetSoftening(const double & eps) {
+        eps2_ = eps * eps;
+    }
+    // Stop conditions; zero disables either.
+    void SetLimits(const double & escape, const double & encounter) {
+        escape2_ = escape * escape;
+        encounter2_ = encounter * encounter;
+    }
+    // One of the splitting schemes from Integrator.hpp.
+    void SetScheme(const int scheme) {
+        switch (scheme) {
+        case scheme__EULER: UseScheme<SemiImplicitEuler>(); break;
+        case scheme__LEAPFROG: UseScheme<Leapfrog>(); break;
+        case scheme__YOSHIDA4: UseScheme<Yoshida4>(); break;
+        case scheme__YOSHIDA6: UseScheme<Yoshida6>(); break;
+        default: throw CustomException("No such ensemble scheme [%d]!", scheme);
+        }
+        scheme_ = scheme;
+    }
+    int GetScheme() const {
+        return scheme_;
+    }
+    static const char * SchemeName(const int scheme) {
+        switch (scheme) {
+        case scheme__EULER: return SemiImplicitEuler::Name();
+        case scheme__LEAPFROG: return Leapfrog::Name();
+        case scheme__YOSHIDA4: return Yoshida4::Name();
+        case scheme__YOSHIDA6: return Yoshida6::Name();
+        default: return "unknown";
+        }
+    }
+    static const char * StopName(const int stop) {
+        switch (stop) {
+        case stop__ESCAPE: return "escape";
+        case stop__ENCOUNTER: return "encounter";
+        default: return "running";
+        }
+    }
+    void SetThreadPool(std::shared_ptr<ThreadPool> pool) {
+        pool_ = pool;
+    }
+    void SetIsa(const int isa) {
+        isa_ = std::min(isa, GravityKernel::Detect());
+    }
+    size_t Bodies() const {
+        return bodies_;
+    }
+    size_t Members() const {
+        return members_;
+    }
+    size_t Running() const {
+        size_t running = 0;
+        for (size_t k = 0; k < members_; ++k) {
+            running += stop_[k] == stop__RUNNING ? 1 : 0;
+        }
+        return running;
+    }
+    // Advances every running member by up to `steps` steps of dt. May be
+    // called again to carry on from where the members are.
+    void Run(const double & dt, const uint64_t steps) {
+        ParallelFor(pool_.get(), 0, stride_ / k_Block, 1, [&](size_t begin, size_t end) {
+            for (size_t block = begin; block < end; ++block) {
+#ifdef GRAV_SIMD_X86
+                if (isa_ == GravityKernel::isa__AVX512) {
+                    AdvanceAvx512(block * k_Block, dt, steps);
+                    continue;
+                }
+                if (isa_ == GravityKernel::isa__AVX2) {
+                    AdvanceAvx2(block * k_Block, dt, steps);
+                    continue;
+                }
+#endif
+                Advance(block * k_Block, dt, steps);
+            }
+        });
+    }
+    std::vector<Result> Results() const {
+        std::vector<Result> results(members_);
+        for (size_t k = 0; k < members_; ++k) {
+            results[k].member = static_cast<uint32_t>(k);
+            results[k].stop = stop_[k];
+            results[k].time = time_[k];
+            results[k].steps = steps_[k];
+        }
+        return results;
+    }
+
+private:
+    template<class Policy>
+    void UseScheme() {
+        static_assert(static_cast<int>(Policy::k_Stages) <= static_cast<int>(k_MaxStages), "Too many stages for the ensemble.");
+        Policy::Coefficients(kick_, drift_);
+        stages_ = Policy::k_Stages;
+    }
+    // Lanes of one pair of bodies, offset to the first member of a block.
+    struct PairLanes {
+        const double * xb;
+        const double * yb;
+        const double * mb;
+        double * axb;
+        double * ayb;
+        const double * xc;
+        const double * yc;
+        const double * mc;
+        double * axc;
+        double * ayc;
+        double * near;
+    };
+
+#ifdef GRAV_SIMD_X86
+    GRAV_TARGET("avx2,fma")
+    void AdvanceAvx2(const size_t k0, const double & dt, const uint64_t steps) {
+        Advance(k0, dt, steps);
+    }
+    GRAV_TARGET("avx512f")
+    void AdvanceAvx512(const size_t k0, const double & dt, const uint64_t steps) {
+        Advance(k0, dt, steps);
+    }
+#endif
+    ENSEMBLE_INLINE void Advance(const size_t k0, const double & dt, const uint64_t steps) {
+        bool valid = false;
+        for (uint64_t s = 0; s < steps; ++s) {
+            bool running = false;
+            for (size_t k = k0; k < k0 + k_Block; ++k) {
+                running = running || live_[k] != 0.0;
+            }
+            if (!running) {
+                break;
+            }
+            for (int stage = 0; stage < stages_; ++stage) {
+                if (kick_[stage] != 0.0) {
+                    if (!valid) {
+                        Accelerate(k0);
+                        valid = true;
+                    }
+                    Update(vx_.Data(), vy_.Data(), ax_.Data(), ay_.Data(), k0, kick_[stage] * dt);
+                }
+                if (drift_[stage] != 0.0) {
+                    Update(x_.Data(), y_.Data(), vx_.Data(), vy_.Data(), k0, drift_[stage] * dt);
+                    valid = false;
+                }
+            }
+            Check(k0, dt);
+        }
+    }
+    // a += b * h on running lanes; stopped lanes add zero.
+    ENSEMBLE_INLINE void Update(double * ax, double * ay, const double * bx, const double * by, const size_t k0, const double & h) {
+        const double * live = live_.Data() + k0;
+        for (size_t b = 0; b < bodies_; ++b) {
+            const size_t o = b * stride_ + k0;
+            for (size_t k = 0; k < k_Block; ++k) {
+                const double hk = h * live[k];
+                ax[o + k] += bx[o + k] * hk;
+                ay[o + k] += by[o + k] * hk;
+            }
+        }
+    }
+    ENSEMBLE_INLINE void Accelerate(const size_t k0) {
+        for (size_t b = 0; b < bodies_; ++b) {
+            std::fill(ax_.Data() + b * stride_ + k0, ax_.Data() + b * stride_ + k0 + k_Block, 0.0);
+            std::fill(ay_.Data() + b * stride_ + k0, ay_.Data() + b * stride_ + k0 + k_Block, 0.0);
+        }
+        std::fill(near_.Data() + k0, near_.Data() + k0 + k_Block, std::numeric_limits<double>::infinity());
+        for (size_t b = 0; b < bodies_; ++b) {
+            for (size_t c = b + 1; c < bodies_; ++c) {
+                const size_t ob = b * stride_ + k0;
+                const size_t oc = c * stride_ + k0;
+                const PairLanes p = {
+                    x_.Data() + ob, y_.Data() + ob, m_.Data() + ob, ax_.Data() + ob, ay_.Data() + ob,
+                    x_.Data() + oc, y_.Data() + oc, m_.Data() + oc, ax_.Data() + oc, ay_.Data() + oc,
+                    near_.Data() + k0,
+                };
+                size_t k = 0;
+#ifdef GRAV_SIMD_X86
+                if (isa_ == GravityKernel::isa__AVX512) {
+                    k = PairAvx512(p, g_, eps2_);
+                } else if (isa_ == GravityKernel::isa__AVX2) {
+                    k = PairAvx2(p, g_, eps2_);
+                }
+#endif
+                PairScalar(p, k, g_, eps2_);
+            }
+        }
+    }
+    // Counts the step for running members and stops those that meet a
+    // condition. Lane loops so the compiler can vectorise them.
+    ENSEMBLE_INLINE void Check(const size_t k0, const double & dt) {
+        double mass[k_Block] = {};
+        double cx[k_Block] = {};
+        double cy[k_Block] = {};
+        double far[k_Block] = {};
+        if (escape2_ > 0.0) {
+            for (size_t b = 0; b < bodies_; ++b) {
+                const double * x = x_.Data() + b * stride_ + k0;
+                const double * y = y_.Data() + b * stride_ + k0;
+                const double * m = m_.Data() + b * stride_ + k0;
+                for (size_t k = 0; k < k_Block; ++k) {
+                    mass[k] += m[k];
+                    cx[k] += m[k] * x[k];
+                    cy[k] += m[k] * y[k];
+                }
+            }
+            for (size_t k = 0; k < k_Block; ++k) {
+                const double inv = mass[k] > 0.0 ? 1.0 / mass[k] : 0.0;
+                cx[k] *= inv;
+                cy[k] *= inv;
+            }
+            for (size_t b = 0; b < bodies_; ++b) {
+                const double * x = x_.Data() + b * stride_ + k0;
+                const double * y = y_.Data() + b * stride_ + k0;
+                for (size_t k = 0; k < k_Block; ++k) {
+                    const double dx = x[k] - cx[k];
+                    const double dy = y[k] - cy[k];
+                    far[k] = std::max(far[k], dx * dx + dy * dy);
+                }
+            }
+        }
+        for (size_t k = 0; k < k_Block; ++k) {
+            const size_t i = k0 + k;
+            if (live_[i] == 0.0) {
+                continue;
+            }
+            time_[i] += dt;
+            ++steps_[i];
+            if (encounter2_ > 0.0 && near_[i] < encounter2_) {
+                Stop(i, stop__ENCOUNTER);
+            } else if (escape2_ > 0.0 && mass[k] > 0.0 && far[k] > escape2_) {
+                Stop(i, stop__ESCAPE);
+            }
+        }
+    }
+    void Stop(const size_t k, const int stop) {
+        stop_[k] = static_cast<uint8_t>(stop);
+        live_[k] = 0.0;
+    }
+
+    // Softened pair force on both bodies, lanes [begin, k_Block). Coincident
+    // bodies (r^2 + eps^2 == 0) exert nothing. Each returns the first lane
+    // left for the scalar tail.
+    static void PairScalar(const PairLanes & p, const size_t begin, const double & g, const double & eps2) {
+        for (size_t k = begin; k < k_Block; ++k) {
+            const double dx = p.xc[k] - p.xb[k];
+            const double dy = p.yc[k] - p.yb[k];
+            const double r2 = dx * dx + dy * dy;
+            const double s2 = r2 + eps2;
+            const double inv = s2 > 0.0 ? 1.0 / sqrt(s2) : 0.0;
+            const double f = g * inv * inv * inv;
+            p.axb[k] += p.mc[k] * f * dx;
+            p.ayb[k] += p.mc[k] * f * dy;
+            p.axc[k] -= p.mb[k] * f * dx;
+            p.ayc[k] -= p.mb[k] * f * dy;
+            p.near[k] = std::min(p.near[k], r2);
+        }
+    }
+
+#ifdef GRAV_SIMD_X86
+    // Full-precision sqrt and divide: a handful of bodies per member leaves
+    // the pair loop short, and members may run for millions of steps.
+    GRAV_TARGET("avx2,fma")
+    static size_t PairAvx2(const PairLanes & p, const double & g_, const double & eps2_) {
+        const __m256d g = _mm256_set1_pd(g_);
+        const __m256d eps2 = _mm256_set1_pd(eps2_);
+        const __m256d one = _mm256_set1_pd(1.0);
+        const __m256d zero = _mm256_setzero_pd();
+        size_t k = 0;
+        for (; k + 4 <= k_Block; k += 4) {
+            const __m256d dx = _mm256_sub_pd(_mm256_load_pd(p.xc + k), _mm256_load_pd(p.xb + k));
+            const __m256d dy = _mm256_sub_pd(_mm256_load_pd(p.yc + k), _mm256_load_pd(p.yb + k));
+            const __m256d r2 = _mm256_fmadd_pd(dx, dx, _mm256_mul_pd(dy, dy));
+            const __m256d s2 = _mm256_add_pd(r2, eps2);
+            __m256d inv = _mm256_div_pd(one, _mm256_sqrt_pd(s2));
+            inv = _mm256_and_pd(inv, _mm256_cmp_pd(s2, zero, _CMP_GT_OQ));
+            const __m256d f = _mm256_mul_pd(g, _mm256_mul_pd(inv, _mm256_mul_pd(inv, inv)));
+            const __m256d fc = _mm256_mul_pd(_mm256_load_pd(p.mc + k), f);
+            const __m256d fb = _mm256_mul_pd(_mm256_load_pd(p.mb + k), f);
+            _mm256_store_pd(p.axb + k, _mm256_fmadd_pd(fc, dx, _mm256_load_pd(p.axb + k)));
+            _mm256_store_pd(p.ayb + k, _mm256_fmadd_pd(fc, dy, _mm256_load_pd(p.ayb + k)));
+            _mm256_store_pd(p.axc + k, _mm256_fnmadd_pd(fb, dx, _mm256_load_pd(p.axc + k)));
+            _mm256_store_pd(p.ayc + k, _mm256_fnmadd_pd(fb, dy, _mm256_load_pd(p.ayc + k)));
+            _mm256_store_pd(p.near + k, _mm256_min_pd(_mm256_load_pd(p.near + k), r2));
+        }
+        return k;
+    }
+
+    GRAV_TARGET("avx512f")
+    static size_t PairAvx512(const PairLanes & p, const double & g_, const double & eps2_) {
+        const __m512d g = _mm512_set1_pd(g_);
+        const __m512d eps2 = _mm512_set1_pd(eps2_);
+        const __m512d one = _mm512_set1_pd(1.0);
+        const __m512d zero = _mm512_setzero_pd();
+        size_t k = 0;
+        for (; k + 8 <= k_Block; k += 8) {
+            const __m512d dx = _mm512_sub_pd(_mm512_load_pd(p.xc + k), _mm512_load_pd(p.xb + k));
+            const __m512d dy = _mm512_sub_pd(_mm512_load_pd(p.yc + k), _mm512_load_pd(p.yb + k));
+            const __m512d r2 = _mm512_fmadd_pd(dx, dx, _mm512_mul_pd(dy, dy));
+            const __m512d s2 = _mm512_add_pd(r2, eps2);
+            const __mmask8 valid = _mm512_cmp_pd_mask(s2, zero, _CMP_GT_OQ);
+            // Masked forms only: GCC's unmasked sqrt and min pass an
+            // _mm512_undefined_pd() through, which -Wall reports as used
+            // uninitialised.
+            const __m512d inv = _mm512_maskz_div_pd(valid, one, _mm512_maskz_sqrt_pd(valid, s2));
+            const __m512d f = _mm512_mul_pd(g, _mm512_mul_pd(inv, _mm512_mul_pd(inv, inv)));
+            const __m512d fc = _mm512_mul_pd(_mm512_load_pd(p.mc + k), f);
+            const __m512d fb = _mm512_mul_pd(_mm512_load_pd(p.mb + k), f);
+            _mm512_store_pd(p.axb + k, _mm512_fmadd_pd(fc, dx, _mm512_load_pd(p.axb + k)));
+            _mm512_store_pd(p.ayb + k, _mm512_fmadd_pd(fc, dy, _mm512_load_pd(p.ayb + k)));
+            _mm512_store_pd(p.axc + k, _mm512_fnmadd_pd(fb, dx, _mm512_load_pd(p.axc + k)));
+            _mm512_store_pd(p.ayc + k, _mm512_fnmadd_pd(fb, dy, _mm512_load_pd(p.ayc + k)));
+            const __m512d near = _mm512_load_pd(p.near + k);
+            _mm512_store_pd(p.near + k, _mm512_mask_blend_pd(_mm512_cmp_pd_mask(r2, near, _CMP_LT_OQ), near, r2));
+        }
+        return k;
+    }
+#endif
+};
+
+#endif // ENSEMBLE_HPP
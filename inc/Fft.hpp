@@ -0,0 +1,151 @@
+#ifndef FFT_HPP
+#define FFT_HPP
+
+#include "AlignedArray.hpp"
+#include "CustomException.hpp"
+#include "ThreadPool.hpp"
+
+#include <algorithm>
+#include <complex>
+#include <vector>
+
+#include <cmath>
+#include <cstdint>
+
+// Complex radix-2 FFT of square power-of-two grids, so the mesh solvers need
+// no external library. One iterative Cooley-Tukey pass per dimension with
+// twiddles and bit reversal planned once per size. Rows are transformed in
+// place; columns are gathered a few at a time into contiguous scratch so every
+// row of the grid is read as one short run. Rows and column blocks are spread
+// over the pool; each is transformed the same way whatever the split, so the
+// result does not depend on the thread count. Transforms are unnormalised: a
+// forward and an inverse pass scale the data by n^2.
+class Fft {
+public:
+    typedef std::complex<double> Complex;
+    typedef AlignedArray<Complex> Grid;
+
+private:
+    enum {
+        // Columns gathered together; 8 complex values fill two cache lines.
+        k_Columns = 8,
+        k_RowGrain = 8,
+    };
+
+    size_t n_;
+    std::vector<Complex> twiddle_;   // exp(-2 pi i k / n), k < n / 2
+    std::vector<uint32_t> reverse_;
+    std::vector<Grid> scratch_;      // column blocks, one per pool thread
+
+public:
+    Fft() : n_(0) {}
+    ~Fft() {}
+    // Prepares transforms of n x n grids; n must be a power of two.
+    void Plan(const size_t n) {
+        if (n == n_) {
+            return;
+        }
+        if (n < 2 || (n & (n - 1)) != 0) {
+            throw CustomException("FFT size [%zu] is not a power of two!", n);
+        }
+        n_ = n;
+        int bits = 0;
+        while ((size_t(1) << bits) < n) {
+            ++bits;
+        }
+        reverse_.resize(n);
+        for (size_t i = 0; i < n; ++i) {
+            uint32_t r = 0;
+            for (int b = 0; b < bits; ++b) {
+                r |= ((i >> b) & 1u) << (bits - 1 - b);
+            }
+            reverse_[i] = r;
+        }
+        const double k_Pi = 3.14159265358979323846;
+        twiddle_.resize(n / 2);
+        for (size_t k = 0; k < n / 2; ++k) {
+            const double a = -2.0 * k_Pi * k / n;
+            twiddle_[k] = Complex(cos(a), sin(a));
+        }
+    }
+    size_t Size() const {
+        return n_;
+    }
+    // Forward transform of a grid whose rows from `rows` on are zero; those
+    // rows skip the first pass since they stay zero.
+    void Forward(ThreadPool * pool, Grid & grid, const size_t rows) {
+        Rows(pool, grid, std::min(rows, n_), false);
+        Columns(pool, grid, false);
+    }
+    // Inverse transform where only rows below `rows` are wanted; the others
+    // are left half transformed.
+    void Inverse(ThreadPool * pool, Grid & grid, const size_t rows) {
+        Columns(pool, grid, true);
+        Rows(pool, grid, std::min(rows, n_), true);
+    }
+    // One-dimensional transform of n_ values in place.
+    void Transform(Complex * a, const bool inverse) const {
+        const size_t n = n_;
+        for (size_t i = 0; i < n; ++i) {
+            const size_t r = reverse_[i];
+            if (i < r) {
+                std::swap(a[i], a[r]);
+            }
+        }
+        for (size_t half = 1; half < n; half <<= 1) {
+            const size_t step = n / (2 * half);
+            for (size_t start = 0; start < n; start += 2 * half) {
+                for (size_t k = 0; k < half; ++k) {
+                    const Complex & t = twiddle_[k * step];
+                    const Complex w = inverse ? std::conj(t) : t;
+                    const Complex u = a[start + k];
+                    const Complex v = a[start + k + half] * w;
+                    a[start + k] = u + v;
+                    a[start + k + half] = u - v;
+                }
+            }
+        }
+    }
+
+private:
+    void Rows(ThreadPool * pool, Grid & grid, const size_t rows, const bool inverse) const {
+        ParallelFor(pool, 0, rows, k_RowGrain, [&](size_t begin, size_t end) {
+            for (size_t r = begin; r < end; ++r) {
+                Transform(grid.Data() + r * n_, inverse);
+            }
+        });
+    }
+    void Columns(ThreadPool * pool, Grid & grid, const bool inverse) {
+        const size_t n = n_;
+        const size_t blocks = (n + k_Columns - 1) / k_Columns;
+        // Grown once per size and thread count, then reused.
+        if (scratch_.size() < PoolThreads(pool)) {
+            scratch_.resize(PoolThreads(pool));
+        }
+        ParallelFor(pool, 0, blocks, 1, [&](size_t begin, size_t end) {
+            Grid & scratch = scratch_[PoolSlot(pool)];
+            scratch.Resize(k_Columns * n);
+            for (size_t b = begin; b < end; ++b) {
+                const size_t c0 = b * k_Columns;
+                const size_t width = std::min(static_cast<size_t>(k_Columns), n - c0);
+                for (size_t r = 0; r < n; ++r) {
+                    const Complex * row = grid.Data() + r * n + c0;
+                    for (size_t c = 0; c < width; ++c) {
+                        scratch[c * n + r] = row[c];
+                    }
+                }
+                for (size_t c = 0; c < width; ++c) {
+                    Transform(&scratch[c * n], inverse);
+                }
+                for (size_t r = 0; r < n; ++r) {
+                    Complex * row = grid.Data() + r * n + c0;
+                    for (size_t c = 0; c < width; ++c) {
+                        row[c] = scratch[c * n + r];
+                    }
+                }
+            }
+        });
+    }
+};
+
+#endif // FFT_HPP
@@ -0,0 +1,609 @@
+#ifndef FMM_ENGINE_HPP
+#define FMM_ENGINE_HPP
+
+#include "AlignedArray.hpp"
+#include "ForceEngine.hpp"
+#include "GravityKernel.hpp"
+#include "Morton.hpp"
+#include "RadixSort.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <vector>
+
+#include <cmath>
+#include <cstdint>
+
+// Fast multipole solver, O(N) for a fixed order and opening angle. Every cell
+// carries a multipole expansion of its bodies about its centre of mass, and
+// two cells far enough apart interact through one multipole-to-local
+// translation instead of body by body or cell by body. Locals are pushed down
+// the tree to the leaves and evaluated at each body.
+//
+// The bodies are planar but attract with the 3D 1/r potential, which is not
+// harmonic in the plane, so complex Laurent series of the 2D log potential do
+// not apply. Expansions are Cartesian Taylor series of the softened 1/r in
+// the two in-plane offsets instead: (p + 1)(p + 2) / 2 terms for order p.
+// Derivatives of (r^2 + eps^2)^-1/2 have a closed form in x, y and the
+// derivatives with respect to r^2, so softening is expanded exactly.
+//
+// The tree comes from the same Morton sort as the Barnes-Hut engine, but a
+// cell is split only while it holds more than k_LeafSize bodies, and levels
+// with a single non-empty quadrant are skipped. A cell's bodies are one run
+// of the sorted arrays, so any cell can also act as a plain point-mass source.
+//
+// Cells A and B are well separated when (r_A + r_B) < theta |c_A - c_B|, r
+// being the distance from the centre to the farthest body. The walk is
+// one-sided: it only ever adds to A's local or A's bodies, so the tree is cut
+// into tasks of a few thousand bodies and each task walks against the whole
+// tree on its own thread, with no locking and a result that does not depend
+// on the pool. Pairs that fail the test are split on the larger cell; two
+// leaves, or pairs whose bodies are cheaper than a translation, go to
+// GravityKernel directly.
+class FmmEngine : public ForceEngine {
+public:
+    enum {
+        k_MinOrder = 1,
+        k_MaxOrder = 12,
+    };
+
+private:
+    enum {
+        // Quantisation levels per axis; bodies closer than box / 2^31 share
+        // a leaf whatever its size.
+        k_MaxDepth = 31,
+        k_Grain = 4096,
+        k_LeafSize = 64,
+        // Bodies per independent task.
+        k_TaskBodies = 4096,
+        k_MaxTerms = (k_MaxOrder + 1) * (k_MaxOrder + 2) / 2,
+    };
+    struct Cell {
+        double cx, cy;      // expansion centre, the centre of mass
+        double radius;      // farthest body from the centre
+        double mass;
+        uint32_t first;     // first sorted body
+        uint32_t count;
+        uint32_t child;     // children are contiguous; 0 for a leaf
+        uint32_t children;
+    };
+    // One product of the multipole-to-local sum: L[l] += D[d] M[m].
+    struct Product {
+        uint16_t l, d, m;
+    };
+    // One term of a derivative: D[d] += c (2x)^x (2y)^y f^(f)(R).
+    struct Derivative {
+        double c;
+        uint16_t d;
+        uint8_t x, y, f;
+    };
+    // Work done by one thread, added to the totals once per chunk.
+    struct Tally {
+        uint64_t pairs;
+        uint64_t translations;
+    };
+
+    double theta_;
+    int expansion_order_;
+    size_t terms_;
+    GravityKernel kernel_;
+    std::atomic<uint64_t> pairs_;
+    std::atomic<uint64_t> translations_;
+    // Coefficients of the derivatives of f(x^2): d^a/dx^a f = sum_i
+    // hermite_[a][i] (2x)^(a - 2i) f^(a - i).
+    double hermite_[k_MaxOrder + 1][k_MaxOrder / 2 + 1];
+    // Both sums flattened for the current order, so a translation is two
+    // straight loops without index arithmetic.
+    std::vector<Product> products_;
+    std::vector<Derivative> derivatives_;
+
+    AlignedArray<Cell> cells_;
+    AlignedArray<double> multipoles_;    // terms_ per cell
+    AlignedArray<double> locals_;
+    AlignedArray<uint32_t> tasks_;       // roots of the independent subtrees
+    AlignedArray<uint32_t> top_;         // cells above them, in pre-order
+
+    RadixSorter sorter_;
+    AlignedArray<uint64_t> keys_;
+    AlignedArray<uint32_t> order_;       // sorted position -> body index
+    AlignedArray<double> sx_, sy_, sm_;  // bodies in sorted order
+    AlignedArray<double> sax_, say_;
+    AlignedArray<uint8_t> wanted_;       // per body: wanted by ComputeActive()
+    AlignedArray<uint32_t> marked_;      // wanted bodies before each sorted position
+
+public:
+    FmmEngine()
+    : theta_(0.6)
+    , expansion_order_(0)
+    , terms_(0)
+    , pairs_(0)
+    , translations_(0)
+    {
+        double fact[k_MaxOrder + 1];
+        fact[0] = 1.0;
+        for (int k = 1; k <= k_MaxOrder; ++k) {
+            fact[k] = fact[k - 1] * k;
+        }
+        for (int a = 0; a <= k_MaxOrder; ++a) {
+            for (int i = 0; i <= k_MaxOrder / 2; ++i) {
+                hermite_[a][i] = 2 * i <= a ? fact[a] / (fact[i] * fact[a - 2 * i]) : 0.0;
+            }
+        }
+        SetOrder(6);
+    }
+    ~FmmEngine() {}
+    const char * Name() const override {
+        return "FMM";
+    }
+    // Opening angle of the separation test; below 1 for the series to
+    // converge. Smaller is more accurate and more expensive.
+    void SetTheta(const double & theta) {
+        theta_ = theta;
+    }
+    double GetTheta() const {
+        return theta_;
+    }
+    // Expansion order; the error falls by about a factor theta per order.
+    void SetOrder(const int order) {
+        expansion_order_ = std::min(std::max(order, static_cast<int>(k_MinOrder)), static_cast<int>(k_MaxOrder));
+        terms_ = Terms(expansion_order_);
+
+        products_.clear();
+        derivatives_.clear();
+        for (int n = 0; n <= expansion_order_; ++n) {
+            for (int j = 0; j <= n; ++j) {
+                const int i = n - j;
+                for (int nb = 0; nb <= expansion_order_ - n; ++nb) {
+                    for (int jb = 0; jb <= nb; ++jb) {
+                        const Product p = {
+                            static_cast<uint16_t>(Index(i, j)),
+                            static_cast<uint16_t>(Index(i + nb - jb, j + jb)),
+                            static_cast<uint16_t>(Index(nb - jb, jb)),
+                        };
+                        products_.push_back(p);
+                    }
+                }
+                for (int ki = 0; 2 * ki <= i; ++ki) {
+                    for (int kj = 0; 2 * kj <= j; ++kj) {
+                        const Derivative d = {
+                            hermite_[i][ki] * hermite_[j][kj],
+                            static_cast<uint16_t>(Index(i, j)),
+                            static_cast<uint8_t>(i - 2 * ki),
+                            static_cast<uint8_t>(j - 2 * kj),
+                            static_cast<uint8_t>(n - ki - kj),
+                        };
+                        derivatives_.push_back(d);
+                    }
+                }
+            }
+        }
+    }
+    int GetOrder() const {
+        return expansion_order_;
+    }
+    size_t CellCount() const {
+        return cells_.Size();
+    }
+    // Body-body interactions in the last evaluation.
+    uint64_t Interactions() const {
+        return pairs_;
+    }
+    // Multipole-to-local translations in the last evaluation.
+    uint64_t Translations() const {
+        return translations_;
+    }
+    void Compute(Particles & bodies) override {
+        Build(bodies);
+        marked_.Clear();
+        Evaluate(bodies);
+    }
+    // The tree and expansions still cover every body; tasks and cells
+    // without a listed body are skipped on the target side.
+    void ComputeActive(Particles & bodies, const uint32_t * active, const size_t count) override {
+        Build(bodies);
+        const size_t n = bodies.Size();
+        wanted_.Resize(n);
+        wanted_.Fill(0);
+        for (size_t k = 0; k < count; ++k) {
+            wanted_[active[k]] = 1;
+        }
+        marked_.Resize(n + 1);
+        marked_[0] = 0;
+        for (size_t k = 0; k < n; ++k) {
+            marked_[k + 1] = marked_[k] + wanted_[order_.Empty() ? k : order_[k]];
+        }
+        Evaluate(bodies);
+    }
+
+private:
+    static size_t Terms(const int order) {
+        return static_cast<size_t>((order + 1) * (order + 2) / 2);
+    }
+    // Coefficient slot of x^a y^b.
+    static size_t Index(const int a, const int b) {
+        const int n = a + b;
+        return static_cast<size_t>(n * (n + 1) / 2 + b);
+    }
+    bool Wanted(const uint32_t first, const uint32_t count) const {
+        return marked_.Empty() || marked_[first + count] != marked_[first];
+    }
+
+    void Build(const Particles & bodies) {
+        ThreadPool * pool = pool_.get();
+        const size_t n = bodies.Size();
+        const size_t live = bodies.Alive();
+        pairs_ = 0;
+        translations_ = 0;
+        cells_.Clear();
+        tasks_.Clear();
+        top_.Clear();
+        order_.Clear();
+        if (live == 0) {
+            return;
+        }
+
+        // Dead bodies carry the all-ones key and end up past `live`.
+        MortonKeys(bodies, pool, k_MaxDepth, keys_);
+        order_.Resize(n);
+        ParallelFor(pool, 0, n, k_Grain, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; ++i) {
+                order_[i] = static_cast<uint32_t>(i);
+            }
+        });
+        sorter_.Sort(pool, keys_, order_);
+
+        sx_.Resize(live);
+        sy_.Resize(live);
+        sm_.Resize(live);
+        sax_.Resize(live);
+        say_.Resize(live);
+        ParallelFor(pool, 0, live, k_Grain, [&](size_t begin, size_t end) {
+            for (size_t k = begin; k < end; ++k) {
+                const uint32_t i = order_[k];
+                sx_[k] = bodies.x[i];
+                sy_[k] = bodies.y[i];
+                sm_[k] = bodies.m[i];
+            }
+        });
+
+        cells_.PushBack(Cell());
+        Split(0, 0, static_cast<uint32_t>(live), 0);
+        Partition(0);
+
+        multipoles_.Resize(cells_.Size() * terms_);
+        locals_.Resize(cells_.Size() * terms_);
+        locals_.Fill(0.0);
+        ParallelFor(pool, 0, tasks_.Size(), 1, [&](size_t begin, size_t end) {
+            for (size_t t = begin; t < end; ++t) {
+                Upward(tasks_[t]);
+            }
+        });
+        for (size_t k = top_.Size(); k-- > 0; ) {
+            Gather(top_[k]);
+        }
+    }
+    // Fills cell `index` with sorted bodies [first, first + count), whose
+    // keys share the leading `depth` levels, and appends its subtree.
+    void Split(const uint32_t index, const uint32_t first, const uint32_t count, int depth) {
+        cells_[index].first = first;
+        cells_[index].count = count;
+        cells_[index].child = 0;
+        cells_[index].children = 0;
+        if (count <= k_LeafSize) {
+            return;
+        }
+        const uint64_t * keys = keys_.Data();
+        uint32_t bounds[5];
+        int quadrants = 0;
+        for (; depth < k_MaxDepth; ++depth) {
+            // Start of each quadrant one level down; the run ends at `end`.
+            const int shift = 2 * (k_MaxDepth - depth - 1);
+            const uint64_t prefix = (keys[first] >> (shift + 2)) << 2;
+            bounds[0] = first;
+            bounds[4] = first + count;
+            for (int q = 1; q < 4; ++q) {
+                bounds[q] = static_cast<uint32_t>(std::lower_bound(keys + bounds[q - 1], keys + first + count, (prefix | q) << shift) - keys);
+            }
+            quadrants = 0;
+            for (int q = 0; q < 4; ++q) {
+                quadrants += bounds[q + 1] > bounds[q] ? 1 : 0;
+            }
+            if (quadrants > 1) {
+                break;
+            }
+        }
+        if (depth == k_MaxDepth) {
+            return;
+        }
+
+        const uint32_t child = static_cast<uint32_t>(cells_.Size());
+        cells_[index].child = child;
+        cells_[index].children = static_cast<uint32_t>(quadrants);
+        for (int q = 0; q < quadrants; ++q) {
+            cells_.PushBack(Cell());
+        }
+        uint32_t c = child;
+        for (int q = 0; q < 4; ++q) {
+            if (bounds[q + 1] > bounds[q]) {
+                Split(c++, bounds[q], bounds[q + 1] - bounds[q], depth + 1);
+            }
+        }
+    }
+    // Cuts the tree into task subtrees; what lies above them is `top_`.
+    void Partition(const uint32_t k) {
+        const Cell & cell = cells_[k];
+        if (cell.count <= k_TaskBodies || cell.children == 0) {
+            tasks_.PushBack(k);
+            return;
+        }
+        top_.PushBack(k);
+        for (uint32_t c = cell.child; c < cell.child + cell.children; ++c) {
+            Partition(c);
+        }
+    }
+    void Upward(const uint32_t k) {
+        const Cell & cell = cells_[k];
+        for (uint32_t c = cell.child; c < cell.child + cell.children; ++c) {
+            Upward(c);
+        }
+        if (cell.children == 0) {
+            Leaf(k);
+        } else {
+            Gather(k);
+        }
+    }
+    // Moments of a leaf straight from its bodies.
+    void Leaf(const uint32_t k) {
+        Cell & cell = cells_[k];
+        double mass = 0.0, mx = 0.0, my = 0.0, x = 0.0, y = 0.0;
+        for (uint32_t b = cell.first; b < cell.first + cell.count; ++b) {
+            mass += sm_[b];
+            mx += sm_[b] * sx_[b];
+            my += sm_[b] * sy_[b];
+            x += sx_[b];
+            y += sy_[b];
+        }
+        Centre(cell, mass, mx, my, x, y);
+
+        double * m = multipoles_.Data() + k * terms_;
+        std::fill(m, m + terms_, 0.0);
+        double radius2 = 0.0;
+        double px[k_MaxOrder + 1], py[k_MaxOrder + 1];
+        for (uint32_t b = cell.first; b < cell.first + cell.count; ++b) {
+            const double ux = sx_[b] - cell.cx;
+            const double uy = sy_[b] - cell.cy;
+            radius2 = std::max(radius2, ux * ux + uy * uy);
+            Powers(ux, uy, px, py);
+            for (int n = 0; n <= expansion_order_; ++n) {
+                for (int j = 0; j <= n; ++j) {
+                    m[Index(n - j, j)] += sm_[b] * px[n - j] * py[j];
+                }
+            }
+        }
+        cell.radius = sqrt(radius2);
+    }
+    // Moments of an inner cell from its children's, shifted to its centre.
+    void Gather(const uint32_t k) {
+        Cell & cell = cells_[k];
+        double mass = 0.0, mx = 0.0, my = 0.0, x = 0.0, y = 0.0;
+        for (uint32_t c = cell.child; c < cell.child + cell.children; ++c) {
+            const Cell & child = cells_[c];
+            mass += child.mass;
+            mx += child.mass * child.cx;
+            my += child.mass * child.cy;
+            x += child.count * child.cx;
+            y += child.count * child.cy;
+        }
+        Centre(cell, mass, mx, my, x, y);
+
+        // M[b] = sum over g <= b of M_child[g] d^(b - g) / (b - g)!
+        double * m = multipoles_.Data() + k * terms_;
+        std::fill(m, m + terms_, 0.0);
+        double radius = 0.0;
+        double px[k_MaxOrder + 1], py[k_MaxOrder + 1];
+        for (uint32_t c = cell.child; c < cell.child + cell.children; ++c) {
+            const Cell & child = cells_[c];
+            const double dx = child.cx - cell.cx;
+            const double dy = child.cy - cell.cy;
+            radius = std::max(radius, sqrt(dx * dx + dy * dy) + child.radius);
+            Powers(dx, dy, px, py);
+            const double * mc = multipoles_.Data() + c * terms_;
+            for (int n = 0; n <= expansion_order_; ++n) {
+                for (int j = 0; j <= n; ++j) {
+                    const int i = n - j;
+                    double sum = 0.0;
+                    for (int gi = 0; gi <= i; ++gi) {
+                        for (int gj = 0; gj <= j; ++gj) {
+                            sum += mc[Index(gi, gj)] * px[i - gi] * py[j - gj];
+                        }
+                    }
+                    m[Index(i, j)] += sum;
+                }
+            }
+        }
+        cell.radius = radius;
+    }
+    // Massless cells still need a centre among their bodies for the
+    // separation test, so they take the plain mean (x, y summed positions).
+    static void Centre(Cell & cell, const double & mass, const double & mx, const double & my, const double & x, const double & y) {
+        cell.mass = mass;
+        if (mass > 0.0) {
+            cell.cx = mx / mass;
+            cell.cy = my / mass;
+        } else {
+            cell.cx = x / cell.count;
+            cell.cy = y / cell.count;
+        }
+    }
+    // x^k / k! and y^k / k! for k <= order.
+    void Powers(const double & x, const double & y, double * px, double * py) const {
+        px[0] = 1.0;
+        py[0] = 1.0;
+        for (int k = 1; k <= expansion_order_; ++k) {
+            px[k] = px[k - 1] * x / k;
+            py[k] = py[k - 1] * y / k;
+        }
+    }
+
+    void Evaluate(Particles & bodies) {
+        const size_t live = cells_.Empty() ? 0 : cells_[0].count;
+        for (size_t k = live; k < bodies.Size(); ++k) {
+            const uint32_t i = order_.Empty() ? static_cast<uint32_t>(k) : order_[k];
+            if (Wanted(static_cast<uint32_t>(k), 1)) {
+                bodies.ax[i] = 0.0;
+                bodies.ay[i] = 0.0;
+            }
+        }
+        ParallelFor(pool_.get(), 0, tasks_.Size(), 1, [&](size_t begin, size_t end) {
+            Tally tally = { 0, 0 };
+            for (size_t t = begin; t < end; ++t) {
+                const Cell & task = cells_[tasks_[t]];
+                if (!Wanted(task.first, task.count)) {
+                    continue;
+                }
+                std::fill(sax_.Data() + task.first, sax_.Data() + task.first + task.count, 0.0);
+                std::fill(say_.Data() + task.first, say_.Data() + task.first + task.count, 0.0);
+                Interact(tasks_[t], 0, tally);
+                Downward(tasks_[t]);
+                for (uint32_t k = task.first; k < task.first + task.count; ++k) {
+                    if (Wanted(k, 1)) {
+                        bodies.ax[order_[k]] = sax_[k];
+                        bodies.ay[order_[k]] = say_[k];
+                    }
+                }
+            }
+            pairs_ += tally.pairs;
+            translations_ += tally.translations;
+        });
+    }
+    // Everything source cell b does to target cell a.
+    void Interact(const uint32_t a, const uint32_t b, Tally & tally) {
+        const Cell & ta = cells_[a];
+        const Cell & sb = cells_[b];
+        if (sb.mass <= 0.0 || !Wanted(ta.first, ta.count)) {
+            return;
+        }
+        // A translation costs about as much as terms^2 / 4 body pairs.
+        const uint64_t direct = static_cast<uint64_t>(ta.count) * sb.count;
+        const uint64_t cheap = terms_ * terms_ / 4;
+        const double dx = ta.cx - sb.cx;
+        const double dy = ta.cy - sb.cy;
+        const double r = ta.radius + sb.radius;
+        if (r * r < theta_ * theta_ * (dx * dx + dy * dy) && direct > cheap) {
+            Translate(a, b);
+            ++tally.translations;
+            return;
+        }
+        if ((ta.children == 0 && sb.children == 0) || direct <= cheap) {
+            Direct(ta, sb);
+            tally.pairs += direct;
+            return;
+        }
+        if (sb.children == 0 || (ta.children != 0 && ta.radius > sb.radius)) {
+            for (uint32_t c = ta.child; c < ta.child + ta.children; ++c) {
+                Interact(c, b, tally);
+            }
+        } else {
+            for (uint32_t c = sb.child; c < sb.child + sb.children; ++c) {
+                Interact(a, c, tally);
+            }
+        }
+    }
+    void Direct(const Cell & a, const Cell & b) {
+        const KernelTargets targets = { sx_.Data() + a.first, sy_.Data() + a.first, sax_.Data() + a.first, say_.Data() + a.first };
+        const KernelSources sources = { sx_.Data() + b.first, sy_.Data() + b.first, sm_.Data() + b.first, b.count };
+        kernel_.Evaluate(targets, 0, a.count, sources, g_, eps2_, true);
+    }
+    // Multipole of b to the local of a. With r the offset from b's centre to
+    // a's, t a target's offset in a and u a source's in b,
+    // f(r + t - u) = sum D[a + b](r) t^a / a! (-u)^b / b!, so
+    // L[a] += sum (-1)^|b| D[a + b] M[b].
+    void Translate(const uint32_t a, const uint32_t b) {
+        const Cell & ta = cells_[a];
+        const Cell & sb = cells_[b];
+        double d[k_MaxTerms];
+        Derivatives(ta.cx - sb.cx, ta.cy - sb.cy, d);
+        // (-1)^|b| folded into a copy of the multipole.
+        const double * mb = multipoles_.Data() + b * terms_;
+        double m[k_MaxTerms];
+        for (int n = 0; n <= expansion_order_; ++n) {
+            const double sign = (n & 1) ? -1.0 : 1.0;
+            for (size_t k = Index(n, 0); k <= Index(0, n); ++k) {
+                m[k] = sign * mb[k];
+            }
+        }
+        double * l = locals_.Data() + a * terms_;
+        for (const Product & p : products_) {
+            l[p.l] += d[p.d] * m[p.m];
+        }
+    }
+    // D[a, b] = d^a/dx^a d^b/dy^b (x^2 + y^2 + eps^2)^-1/2 for a + b <= order.
+    void Derivatives(const double & x, const double & y, double * d) const {
+        // f[n] = (d/dR)^n R^-1/2, with R = x^2 + y^2 + eps^2.
+        const double inv_r2 = 1.0 / (x * x + y * y + eps2_);
+        double f[k_MaxOrder + 1];
+        f[0] = sqrt(inv_r2);
+        for (int n = 0; n < expansion_order_; ++n) {
+            f[n + 1] = -(2 * n + 1) * 0.5 * inv_r2 * f[n];
+        }
+        double px[k_MaxOrder + 1], py[k_MaxOrder + 1];
+        px[0] = 1.0;
+        py[0] = 1.0;
+        for (int k = 1; k <= expansion_order_; ++k) {
+            px[k] = px[k - 1] * 2.0 * x;
+            py[k] = py[k - 1] * 2.0 * y;
+        }
+        std::fill(d, d + terms_, 0.0);
+        for (const Derivative & t : derivatives_) {
+            d[t.d] += t.c * px[t.x] * py[t.y] * f[t.f];
+        }
+    }
+    // Pushes locals from cell k to its children, and at the leaves turns them
+    // into accelerations: a = G grad phi, so a_x = G sum L[a + 1, b] t^(a, b) / (a, b)!.
+    void Downward(const uint32_t k) {
+        const Cell & cell = cells_[k];
+        if (!Wanted(cell.first, cell.count)) {
+            return;
+        }
+        const double * l = locals_.Data() + k * terms_;
+        double px[k_MaxOrder + 1], py[k_MaxOrder + 1];
+        if (cell.children == 0) {
+            for (uint32_t b = cell.first; b < cell.first + cell.count; ++b) {
+                Powers(sx_[b] - cell.cx, sy_[b] - cell.cy, px, py);
+                double ax = 0.0, ay = 0.0;
+                for (int n = 0; n < expansion_order_; ++n) {
+                    for (int j = 0; j <= n; ++j) {
+                        const double t = px[n - j] * py[j];
+                        ax += l[Index(n - j + 1, j)] * t;
+                        ay += l[Index(n - j, j + 1)] * t;
+                    }
+                }
+                sax_[b] += g_ * ax;
+                say_[b] += g_ * ay;
+            }
+            return;
+        }
+        // L_child[a] += sum over g >= a of L[g] d^(g - a) / (g - a)!
+        for (uint32_t c = cell.child; c < cell.child + cell.children; ++c) {
+            const Cell & child = cells_[c];
+            Powers(child.cx - cell.cx, child.cy - cell.cy, px, py);
+            double * lc = locals_.Data() + c * terms_;
+            for (int n = 0; n <= expansion_order_; ++n) {
+                for (int j = 0; j <= n; ++j) {
+                    const int i = n - j;
+                    double sum = 0.0;
+                    for (int ng = n; ng <= expansion_order_; ++ng) {
+                        for (int gj = j; gj <= ng - i; ++gj) {
+                            const int gi = ng - gj;
+                            sum += l[Index(gi, gj)] * px[gi - i] * py[gj - j];
+                        }
+                    }
+                    lc[Index(i, j)] += sum;
+                }
+            }
+            Downward(c);
+        }
+    }
+};
+
+#endif // FMM_ENGINE_HPP
@@ -0,0 +1,49 @@
+#ifndef FORCE_ENGINE_HPP
+#define FORCE_ENGINE_HPP
+
+#include "Particles.hpp"
+#include "ThreadPool.hpp"
+
+#include <memory>
+
+// Common interface of the gravity solvers. Compute() overwrites the
+// accelerations (ax, ay) of every body from the current positions.
+class ForceEngine {
+protected:
+    double g_;
+    double eps2_;
+    std::shared_ptr<ThreadPool> pool_;
+
+public:
+    ForceEngine() : g_(1.0), eps2_(0.0) {}
+    virtual ~ForceEngine() {}
+    virtual const char * Name() const = 0;
+    virtual void Compute(Particles & bodies) = 0;
+    // Accelerations of the listed bodies only, still from every source;
+    // other bodies' accelerations may be left untouched. Engines without a
+    // cheaper path fall back to Compute().
+    virtual void ComputeActive(Particles & bodies, const uint32_t * active, const size_t count) {
+        (void)active;
+        (void)count;
+        Compute(bodies);
+    }
+
+    void SetGravitationalConstant(const double & g) {
+        g_ = g;
+    }
+    void SetSoftening(const double & eps) {
+        eps2_ = eps * eps;
+    }
+    double GetGravitationalConstant() const {
+        return g_;
+    }
+    double GetSoftening2() const {
+        return eps2_;
+    }
+    // Engines that can split their work run it on this pool.
+    void SetThreadPool(std::shared_ptr<ThreadPool> pool) {
+        pool_ = pool;
+    }
+};
+
+#endif // FORCE_ENGINE_HPP
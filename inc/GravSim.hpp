@@ -3,38 +3,18 @@
 
 #include "Display.hpp"
 #include "GravUi.hpp"
+#include "Simulation.hpp"
+#include "SimThread.hpp"
 
+#include <algorithm>
 #include <chrono>
-#include <cmath>
+#include <memory>
 
 class GravSim {
 private:
-    const double k_SunMass = 1.98855e30;
-    const double k_EarthMass = 5.9722e24;
-    const double k_GravitationalConstant = 6.67408e-11;
-    const double k_AstronomicalUnit = 1.49598e11;
-    const double k_EarthOrbitalSpeed = 2.9783e4;
-    const double k_Pi = 3.14159265358979323846;
-    const double k_Rad2Deg = 180.0 / k_Pi;
-    const double k_Deg2Rad = k_Pi / 180.0;
-    
-    const double cDistanceFactor = 0.0001;
-    const double cMassFactor = k_GravitationalConstant * 1e-6;
-    const double cSpeedFactor = 0.01;
-    const double cT = cDistanceFactor / cSpeedFactor;
-    
-    const double dt = cT;
-    const double c_SunMass = k_SunMass * cMassFactor * cSpeedFactor * cSpeedFactor * cDistanceFactor;
-    const double c_EarthMass = k_EarthMass * cMassFactor * cSpeedFactor * cSpeedFactor * cDistanceFactor;
-    const double c_GravitationalConstant = k_GravitationalConstant / cMassFactor;
-    const double c_AstronomicalUnit = k_AstronomicalUnit * cDistanceFactor;
-    const double c_EarthOrbitalSpeed = k_EarthOrbitalSpeed * cSpeedFactor;
-    
-    double x_;
-    double y_;
-    double vx_;
-    double vy_;
-    double elapsed_;
+    std::shared_ptr<Simulation> sim_;
+    std::shared_ptr<SimThread> thread_;
+    SimSettings settings_;
 
     std::shared_ptr<GravUi> ui_;
     std::chrono::time_point<std::chrono::high_resolution_clock> start_;
@@ -44,55 +24,133 @@ public:
     GravSim() {}
     ~GravSim() {}
     void Init() {
-        x_ = c_AstronomicalUnit;
-        y_ = 0.0;
-        vx_ = 0.0;
-        vy_ = -c_EarthOrbitalSpeed;
-        elapsed_ = 0.0;
+        sim_ = std::make_shared<Simulation>();
+        sim_->Init();
+        settings_.theta = sim_->DefaultTheta();
 
         ui_ = std::make_shared<GravUi>();
         ui_->Init();
+        ui_->SetEngineNames(sim_->EngineNames());
+        ui_->SetIntegratorNames(sim_->IntegratorNames());
+        ui_->SetTheta(settings_.theta);
+
+        thread_ = std::make_shared<SimThread>(sim_);
 
         start_ = std::chrono::high_resolution_clock::now();
     }
+    // Starts stepping on the simulation thread with the given time step.
+    void Start(const double& dt) {
+        thread_->SetTimeStep(dt);
+        thread_->SetWarp(ui_->GetWarp());
+        thread_->Start();
+    }
+    void Quit() {
+        thread_->Stop();
+    }
     void RenderWorld() {
+        ApplyUiSettings();
+        const SimState & state = thread_->ReadState();
+        const Particles & bodies = state.bodies;
+        const size_t sun = bodies.Heaviest();
+
+        // Draw one step behind the newest state, at the fraction of the step
+        // interval that has passed since it was published, so bodies move
+        // smoothly whatever the ratio of display to step rate.
+        double alpha = 1.0;
+        const bool blend = state.interval > 0.0 && state.previous_x.Size() == bodies.NextId();
+        if (blend) {
+            alpha = std::chrono::duration<double>(std::chrono::steady_clock::now() - state.stamp).count() / state.interval;
+            alpha = std::min(std::max(alpha, 0.0), 1.0);
+        }
+        auto vertex = [&](const size_t i) {
+            if (blend) {
+                const uint32_t id = bodies.id[i];
+                glVertex2d(
+                    state.previous_x[id] + alpha * (bodies.x[i] - state.previous_x[id]),
+                    state.previous_y[id] + alpha * (bodies.y[i] - state.previous_y[id])
+                );
+            } else {
+                glVertex2d(bodies.x[i], bodies.y[i]);
+            }
+        };
+
         // Render Sun
-        glPointSize(10.0);
-        glColor3f(1.0, 1.0, 0.0);
+        if (sun < bodies.Size()) {
+            glPointSize(10.0);
+            glColor3f(1.0, 1.0, 0.0);
+            glBegin(GL_POINTS);
+            vertex(sun);
+            glEnd();
+        }
+
+        // Render tracers underneath the bodies; there may be millions, so
+        // they are small and dim.
+        const size_t tracers = state.tracer_x.Size();
+        const bool blend_tracers = blend && state.previous_tracer_x.Size() == tracers;
+        glPointSize(1.0);
+        glColor3f(0.6, 0.6, 0.6);
         glBegin(GL_POINTS);
-        glVertex2d(0.0, 0.0);
+        for (size_t i = 0; i < tracers; ++i) {
+            if (blend_tracers) {
+                glVertex2d(
+                    state.previous_tracer_x[i] + alpha * (state.tracer_x[i] - state.previous_tracer_x[i]),
+                    state.previous_tracer_y[i] + alpha * (state.tracer_y[i] - state.previous_tracer_y[i])
+                );
+            } else {
+                glVertex2d(state.tracer_x[i], state.tracer_y[i]);
+            }
+        }
         glEnd();
 
-        // Render Earth
+        // Render the other bodies
         glPointSize(5.0);
         glColor3f(1.0, 1.0, 1.0);
         glBegin(GL_POINTS);
-        glVertex2d(x_, y_);
+        for (size_t i = 0; i < bodies.Size(); ++i) {
+            if (i != sun && bodies.alive[i] != 0) {
+                vertex(i);
+            }
+        }
         glEnd();
+
+        clock_ = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start_).count();
+
+        ui_->SetBodies(&bodies);
+        ui_->SetElapsed(state.elapsed);
+        ui_->SetClock(clock_);
+        ui_->SetStepRate(state.step_rate);
+        ui_->SetWarp(state.warp, state.limited);
+        ui_->SetEnergy(state.diagnosed, state.energy_error);
     }
     void RenderUi() {
         ui_->Step();
     }
-    void Step(const double& dt) {
-
-        double a, r, ax, ay;
-
-        const double r2 = x_ * x_ + y_ * y_;
-        a = c_SunMass * c_GravitationalConstant / r2;
-        r = sqrt(r2);
-        ax = -a * x_ / r;
-        ay = -a * y_ / r;
-        vx_ += ax * dt;
-        vy_ += ay * dt;
-        x_ += vx_ * dt;
-        y_ += vy_ * dt;
-        elapsed_ += dt / (cT * 3600.0 * 24);
-        clock_ = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start_).count();
 
-        ui_->SetElapsed(elapsed_);
-        ui_->SetClock(clock_);
+private:
+    void ApplyUiSettings() {
+        SimSettings settings;
+        settings.engine = ui_->GetEngine();
+        settings.integrator = ui_->GetIntegrator();
+        settings.theta = ui_->GetTheta();
+        settings.moments = ui_->GetMoments();
+        settings.order = ui_->GetOrder();
+        settings.tolerance = ui_->GetTolerance();
+        if (settings.engine != settings_.engine ||
+            settings.integrator != settings_.integrator ||
+            settings.theta != settings_.theta ||
+            settings.moments != settings_.moments ||
+            settings.order != settings_.order ||
+            settings.tolerance != settings_.tolerance) {
+            settings_ = settings;
+            thread_->Configure(settings_);
+        }
+        thread_->SetWarp(ui_->GetWarp());
+
+        int scene, count;
+        if (ui_->ConsumeReset(scene, count)) {
+            thread_->RequestReset(scene, count);
+        }
     }
 };
 
 #endif // GRAV_SIM_HPP
-
@@ -2,14 +2,45 @@
 #define GRAV_UI_HPP
 
 #include "GuiBase.hpp"
+#include "Particles.hpp"
+#include "Simulation.hpp"
+
+#include <string>
+#include <vector>
+#include <cmath>
 
 class GravUi : public GuiBase {
 private:
     double var_elapsed_ = 0.0;
     double var_clock_ = 0.0;
+    double var_step_rate_ = 0.0;
+    bool var_diagnosed_ = false;
+    double var_energy_error_ = 0.0;
+    double var_warp_ = 0.0;
+    bool var_limited_ = false;
+    float var_target_warp_ = 0.1f;
+    const Particles * bodies_ = nullptr;
+    std::vector<std::string> engine_names_;
+    int var_engine_ = 0;
+    std::vector<std::string> integrator_names_;
+    int var_integrator_ = 0;
+    float var_theta_ = 0.5f;
+    std::vector<std::string> moments_names_;
+    int var_moments_ = BarnesHutEngine::moments__MONOPOLE;
+    int var_order_ = 6;
+    // Decimal exponent, so the tolerance is the same double --tolerance 1e-9
+    // gives the batch runner.
+    int var_tolerance_exponent_ = -9;
+    int var_scene_ = Simulation::scene__SOLAR;
+    int var_disk_count_ = 10000;
+    bool reset_ = false;
 
 public:
-    GravUi() {}
+    GravUi() {
+        for (int m = BarnesHutEngine::moments__MONOPOLE; m <= BarnesHutEngine::moments__OCTUPOLE; ++m) {
+            moments_names_.push_back(BarnesHutEngine::MomentsName(m));
+        }
+    }
     ~GravUi() {}
     void PreInit() override {}
     void PostInit() override {
@@ -20,6 +51,8 @@ public:
     void PostQuit() override {}
     void RenderWindows() override {
         RenderTest();
+        RenderBodies();
+        RenderEngine();
     }
     void RenderBackground() override {
         ShowVersionInfo();
@@ -30,14 +63,165 @@ public:
     void SetClock(const double& c) {
         var_clock_ = c;
     }
+    void SetStepRate(const double& r) {
+        var_step_rate_ = r;
+    }
+    // Achieved time warp, and whether the CPU budget capped it.
+    void SetWarp(const double& days_per_second, const bool limited) {
+        var_warp_ = days_per_second;
+        var_limited_ = limited;
+    }
+    void SetEnergy(const bool valid, const double& relative_error) {
+        var_diagnosed_ = valid;
+        var_energy_error_ = relative_error;
+    }
+    void SetBodies(const Particles * bodies) {
+        bodies_ = bodies;
+    }
+    void SetEngineNames(const std::vector<std::string>& names) {
+        engine_names_ = names;
+    }
+    void SetIntegratorNames(const std::vector<std::string>& names) {
+        integrator_names_ = names;
+    }
+    void SetTheta(const double& theta) {
+        var_theta_ = static_cast<float>(theta);
+    }
+    int GetEngine() const {
+        return var_engine_;
+    }
+    // Target simulated days per real second, 0 for unlimited.
+    double GetWarp() const {
+        return var_target_warp_;
+    }
+    int GetIntegrator() const {
+        return var_integrator_;
+    }
+    double GetTheta() const {
+        return var_theta_;
+    }
+    int GetMoments() const {
+        return var_moments_;
+    }
+    int GetOrder() const {
+        return var_order_;
+    }
+    double GetTolerance() const {
+        return pow(10.0, var_tolerance_exponent_);
+    }
+    // Returns true once per press of "Reset", with the chosen scene.
+    bool ConsumeReset(int& scene, int& count) {
+        if (!reset_) {
+            return false;
+        }
+        reset_ = false;
+        scene = var_scene_;
+        count = var_disk_count_;
+        return true;
+    }
 
 private:
     void RenderTest() {
         ImGui::Begin("Test");
         ImGui::Text("SimTime : %.1f", var_elapsed_);
         ImGui::Text("RealTime : %.1f", var_clock_);
+        ImGui::Text("Steps/s : %.0f", var_step_rate_);
+        ImGui::Text("Days/s : %.3g", var_warp_);
+        if (var_limited_) {
+            ImGui::SameLine();
+            ImGui::TextColored(ImVec4(1.0f, 0.5f, 0.0f, 1.0f), "(CPU limited, target %.3g)", var_target_warp_);
+        }
+        if (var_diagnosed_) {
+            ImGui::Text("dE/E : %.3e", var_energy_error_);
+        } else {
+            ImGui::Text("dE/E : n/a");
+        }
         ImGui::End();
     }
+    void RenderBodies() {
+        if (bodies_ == nullptr) {
+            return;
+        }
+        ImGui::Begin("Bodies");
+        ImGui::Text("Count : %zu", bodies_->Alive());
+        const ImGuiTableFlags flags = ImGuiTableFlags_RowBg | ImGuiTableFlags_ScrollY;
+        if (ImGui::BeginTable("bodies", 5, flags)) {
+            ImGui::TableSetupScrollFreeze(0, 1);
+            ImGui::TableSetupColumn("Id");
+            ImGui::TableSetupColumn("Mass");
+            ImGui::TableSetupColumn("X");
+            ImGui::TableSetupColumn("Y");
+            ImGui::TableSetupColumn("Speed");
+            ImGui::TableHeadersRow();
+            // Only the visible rows are touched, so large stores stay cheap.
+            // Rows follow ids, so they stay put when storage is reordered.
+            ImGuiListClipper clipper;
+            clipper.Begin(static_cast<int>(bodies_->NextId()));
+            while (clipper.Step()) {
+                for (int row = clipper.DisplayStart; row < clipper.DisplayEnd; ++row) {
+                    const size_t i = bodies_->Find(static_cast<uint32_t>(row));
+                    ImGui::TableNextRow();
+                    ImGui::TableNextColumn();
+                    ImGui::Text("%d", row);
+                    if (i >= bodies_->Size()) {
+                        continue;
+                    }
+                    const double vx = bodies_->vx[i];
+                    const double vy = bodies_->vy[i];
+                    ImGui::TableNextColumn();
+                    ImGui::Text("%.3e", bodies_->m[i]);
+                    ImGui::TableNextColumn();
+                    ImGui::Text("%.1f", bodies_->x[i]);
+                    ImGui::TableNextColumn();
+                    ImGui::Text("%.1f", bodies_->y[i]);
+                    ImGui::TableNextColumn();
+                    ImGui::Text("%.1f", sqrt(vx * vx + vy * vy));
+                }
+            }
+            ImGui::EndTable();
+        }
+        ImGui::End();
+    }
+    void RenderEngine() {
+        ImGui::Begin("Engine");
+        NameCombo("Force", engine_names_, var_engine_);
+        NameCombo("Integrator", integrator_names_, var_integrator_);
+        ImGui::SliderFloat("Theta", &var_theta_, 0.0f, 1.5f, "%.2f");
+        NameCombo("Moments", moments_names_, var_moments_);
+        ImGui::SliderInt("Order", &var_order_, FmmEngine::k_MinOrder, FmmEngine::k_MaxOrder);
+        ImGui::SliderInt("Tolerance", &var_tolerance_exponent_, -14, -3, "1e%d");
+        ImGui::SliderFloat("Days/s", &var_target_warp_, 0.0f, 1000.0f, var_target_warp_ == 0.0f ? "max" : "%.3g", ImGuiSliderFlags_Logarithmic);
+        ImGui::Separator();
+        ImGui::RadioButton("Solar", &var_scene_, Simulation::scene__SOLAR);
+        ImGui::SameLine();
+        ImGui::RadioButton("Disk", &var_scene_, Simulation::scene__DISK);
+        ImGui::SameLine();
+        ImGui::RadioButton("Belt", &var_scene_, Simulation::scene__BELT);
+        if (var_scene_ == Simulation::scene__DISK || var_scene_ == Simulation::scene__BELT) {
+            ImGui::InputInt(var_scene_ == Simulation::scene__BELT ? "Tracers" : "Bodies", &var_disk_count_, 1000, 100000);
+            if (var_disk_count_ < 1) {
+                var_disk_count_ = 1;
+            }
+        }
+        if (ImGui::Button("Reset")) {
+            reset_ = true;
+        }
+        ImGui::End();
+    }
+    void NameCombo(const char * label, const std::vector<std::string>& names, int& index) {
+        if (names.empty()) {
+            return;
+        }
+        if (ImGui::BeginCombo(label, names[index].c_str())) {
+            for (int i = 0; i < static_cast<int>(names.size()); ++i) {
+                const bool selected = (i == index);
+                if (ImGui::Selectable(names[i].c_str(), selected)) {
+                    index = i;
+                }
+            }
+            ImGui::EndCombo();
+        }
+    }
     void ShowVersionInfo() {
         PushFont("version");
         std::string version = "n/a";
@@ -0,0 +1,442 @@
+#ifndef GRAVITY_KERNEL_HPP
+#define GRAVITY_KERNEL_HPP
+
+#include "Logger.hpp"
+
+#include <cmath>
+#include <cstddef>
+
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define GRAV_SIMD_X86 1
+#include <immintrin.h>
+#define GRAV_TARGET(isa) __attribute__((target(isa)))
+#endif
+
+// Bodies whose accelerations are wanted. Plain pointers so the same kernel
+// serves particle stores, gathered subsets and scratch buffers alike.
+struct KernelTargets {
+    const double * x;
+    const double * y;
+    double * ax;
+    double * ay;
+};
+
+// Point masses that attract the targets.
+struct KernelSources {
+    const double * x;
+    const double * y;
+    const double * m;
+    size_t count;
+};
+
+// Bodies of one set that attract each other; accelerations are added to.
+struct KernelBodies {
+    const double * x;
+    const double * y;
+    const double * m;
+    double * ax;
+    double * ay;
+};
+
+// Softened point-mass gravity from every source on targets [begin, end),
+// vectorised over targets: each lane holds one target and sources are
+// broadcast one at a time, so there are no horizontal reductions or scatters.
+// 1/sqrt comes from the hardware estimate refined by two Newton steps. The
+// instruction set is picked once from cpuid with a scalar fallback. Pairs at
+// zero separation (a target among its own sources) contribute nothing.
+//
+// Within one set the mutual form evaluates each pair once and applies it to
+// both bodies, halving the square roots. A tile of one vector width of
+// sources meets blocks of targets: the targets' shares are added back per
+// block, and each source's share builds up in a register of its own that is
+// reduced once the tile has seen every target.
+class GravityKernel {
+public:
+    enum {
+        isa__SCALAR = 0,
+        isa__AVX2,
+        isa__AVX512,
+    };
+
+private:
+    int isa_;
+    int detected_;
+
+public:
+    GravityKernel() {
+        detected_ = Detect();
+        isa_ = detected_;
+    }
+    ~GravityKernel() {}
+    // Forces a lower instruction set, e.g. for comparisons. Requests above
+    // what the CPU supports are clamped.
+    void SetIsa(const int isa) {
+        isa_ = isa < detected_ ? isa : detected_;
+    }
+    int GetIsa() const {
+        return isa_;
+    }
+    // With accumulate set the result is added to the targets' accelerations,
+    // otherwise it replaces them.
+    void Evaluate(
+        const KernelTargets & t, const size_t begin, const size_t end,
+        const KernelSources & s, const double & g, const double & eps2,
+        const bool accumulate = false
+    ) const {
+        size_t i = begin;
+#ifdef GRAV_SIMD_X86
+        if (isa_ == isa__AVX512) {
+            i = EvaluateAvx512(t, begin, end, s, g, eps2, accumulate);
+        } else if (isa_ == isa__AVX2) {
+            i = EvaluateAvx2(t, begin, end, s, g, eps2, accumulate);
+        }
+#endif
+        EvaluateScalar(t, i, end, s, g, eps2, accumulate);
+    }
+
+    // Pairs between bodies [a0, a1) and [b0, b1) of one set, two disjoint
+    // ranges, applied to both sides.
+    void EvaluateMutual(
+        const KernelBodies & p, const size_t a0, const size_t a1, const size_t b0, const size_t b1,
+        const double & g, const double & eps2
+    ) const {
+        size_t a_end = a0;
+        size_t b_end = b0;
+#ifdef GRAV_SIMD_X86
+        const size_t width = Width();
+        if (width > 1) {
+            a_end = a0 + (a1 - a0) / width * width;
+            b_end = b0 + (b1 - b0) / width * width;
+        }
+        if (a_end > a0 && b_end > b0) {
+            if (isa_ == isa__AVX512) {
+                MutualAvx512(p, a0, a_end, b0, b_end, g, eps2);
+            } else {
+                MutualAvx2(p, a0, a_end, b0, b_end, g, eps2);
+            }
+        } else {
+            a_end = a0;
+        }
+#endif
+        MutualScalar(p, a_end, a1, b0, b1, g, eps2);
+        MutualScalar(p, a0, a_end, b_end, b1, g, eps2);
+    }
+    // Every pair within bodies [begin, end), once each.
+    void EvaluateMutual(const KernelBodies & p, const size_t begin, const size_t end, const double & g, const double & eps2) const {
+        const size_t width = Width();
+        size_t t = begin;
+        for (; width > 1 && t + width <= end; t += width) {
+            // The tile against the targets before it, then against itself,
+            // where symmetry would not pay.
+            EvaluateMutual(p, begin, t, t, t + width, g, eps2);
+            const KernelTargets targets = { p.x, p.y, p.ax, p.ay };
+            const KernelSources sources = { p.x + t, p.y + t, p.m + t, width };
+            Evaluate(targets, t, t + width, sources, g, eps2, true);
+        }
+        EvaluateMutual(p, begin, t, t, end, g, eps2);
+        for (size_t i = t; i < end; ++i) {
+            MutualScalar(p, i, i + 1, i + 1, end, g, eps2);
+        }
+    }
+
+    static const char * IsaName(const int isa) {
+        switch (isa) {
+        case isa__AVX512: return "AVX-512";
+        case isa__AVX2: return "AVX2";
+        default: return "scalar";
+        }
+    }
+    static int Detect() {
+#ifdef GRAV_SIMD_X86
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx512f")) {
+            return isa__AVX512;
+        }
+        if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+            return isa__AVX2;
+        }
+#endif
+        return isa__SCALAR;
+    }
+
+private:
+    // Lanes of the active instruction set.
+    size_t Width() const {
+        switch (isa_) {
+        case isa__AVX512: return 8;
+        case isa__AVX2: return 4;
+        default: return 1;
+        }
+    }
+    static void MutualScalar(
+        const KernelBodies & p, const size_t a0, const size_t a1, const size_t b0, const size_t b1,
+        const double & g, const double & eps2
+    ) {
+        for (size_t i = a0; i < a1; ++i) {
+            const double xi = p.x[i];
+            const double yi = p.y[i];
+            const double gmi = g * p.m[i];
+            double axi = 0.0;
+            double ayi = 0.0;
+            for (size_t j = b0; j < b1; ++j) {
+                const double dx = p.x[j] - xi;
+                const double dy = p.y[j] - yi;
+                const double r2 = dx * dx + dy * dy + eps2;
+                if (r2 <= 0.0) {
+                    continue;
+                }
+                const double inv_r = 1.0 / sqrt(r2);
+                const double inv_r3 = inv_r * inv_r * inv_r;
+                const double fi = g * p.m[j] * inv_r3;
+                const double fj = gmi * inv_r3;
+                axi += fi * dx;
+                ayi += fi * dy;
+                p.ax[j] -= fj * dx;
+                p.ay[j] -= fj * dy;
+            }
+            p.ax[i] += axi;
+            p.ay[i] += ayi;
+        }
+    }
+    static void EvaluateScalar(
+        const KernelTargets & t, const size_t begin, const size_t end,
+        const KernelSources & s, const double & g, const double & eps2,
+        const bool accumulate
+    ) {
+        for (size_t i = begin; i < end; ++i) {
+            const double xi = t.x[i];
+            const double yi = t.y[i];
+            double axi = 0.0;
+            double ayi = 0.0;
+            for (size_t j = 0; j < s.count; ++j) {
+                const double dx = s.x[j] - xi;
+                const double dy = s.y[j] - yi;
+                const double r2 = dx * dx + dy * dy + eps2;
+                if (r2 <= 0.0) {
+                    continue;
+                }
+                const double inv_r = 1.0 / sqrt(r2);
+                const double f = g * s.m[j] * inv_r * inv_r * inv_r;
+                axi += f * dx;
+                ayi += f * dy;
+            }
+            if (accumulate) {
+                t.ax[i] += axi;
+                t.ay[i] += ayi;
+            } else {
+                t.ax[i] = axi;
+                t.ay[i] = ayi;
+            }
+        }
+    }
+
+#ifdef GRAV_SIMD_X86
+    // Each returns the first target index left for the scalar tail.
+    GRAV_TARGET("avx2,fma")
+    static size_t EvaluateAvx2(
+        const KernelTargets & t, const size_t begin, const size_t end,
+        const KernelSources & s, const double & g, const double & eps2_,
+        const bool accumulate
+    ) {
+        const __m256d eps2 = _mm256_set1_pd(eps2_);
+        const __m256d half = _mm256_set1_pd(0.5);
+        const __m256d three_halves = _mm256_set1_pd(1.5);
+        const __m256d zero = _mm256_setzero_pd();
+
+        size_t i = begin;
+        for (; i + 4 <= end; i += 4) {
+            const __m256d xi = _mm256_loadu_pd(t.x + i);
+            const __m256d yi = _mm256_loadu_pd(t.y + i);
+            __m256d axi = zero;
+            __m256d ayi = zero;
+            for (size_t j = 0; j < s.count; ++j) {
+                const __m256d dx = _mm256_sub_pd(_mm256_set1_pd(s.x[j]), xi);
+                const __m256d dy = _mm256_sub_pd(_mm256_set1_pd(s.y[j]), yi);
+                const __m256d r2 = _mm256_fmadd_pd(dx, dx, _mm256_fmadd_pd(dy, dy, eps2));
+                // Single precision estimate (~12 bits), two Newton steps to
+                // ~46 bits. Needs r2 inside float range, which holds for the
+                // scaled simulation units.
+                __m256d inv = _mm256_cvtps_pd(_mm_rsqrt_ps(_mm256_cvtpd_ps(r2)));
+                const __m256d h = _mm256_mul_pd(half, r2);
+                inv = _mm256_mul_pd(inv, _mm256_fnmadd_pd(h, _mm256_mul_pd(inv, inv), three_halves));
+                inv = _mm256_mul_pd(inv, _mm256_fnmadd_pd(h, _mm256_mul_pd(inv, inv), three_halves));
+                // Self (and coincident) pairs have r2 == 0; mask them out.
+                inv = _mm256_and_pd(inv, _mm256_cmp_pd(r2, zero, _CMP_GT_OQ));
+                const __m256d inv3 = _mm256_mul_pd(inv, _mm256_mul_pd(inv, inv));
+                const __m256d f = _mm256_mul_pd(_mm256_set1_pd(g * s.m[j]), inv3);
+                axi = _mm256_fmadd_pd(f, dx, axi);
+                ayi = _mm256_fmadd_pd(f, dy, ayi);
+            }
+            if (accumulate) {
+                axi = _mm256_add_pd(axi, _mm256_loadu_pd(t.ax + i));
+                ayi = _mm256_add_pd(ayi, _mm256_loadu_pd(t.ay + i));
+            }
+            _mm256_storeu_pd(t.ax + i, axi);
+            _mm256_storeu_pd(t.ay + i, ayi);
+        }
+        return i;
+    }
+
+    GRAV_TARGET("avx512f")
+    static size_t EvaluateAvx512(
+        const KernelTargets & t, const size_t begin, const size_t end,
+        const KernelSources & s, const double & g, const double & eps2_,
+        const bool accumulate
+    ) {
+        const __m512d eps2 = _mm512_set1_pd(eps2_);
+        const __m512d half = _mm512_set1_pd(0.5);
+        const __m512d three_halves = _mm512_set1_pd(1.5);
+        const __m512d zero = _mm512_setzero_pd();
+
+        size_t i = begin;
+        for (; i + 8 <= end; i += 8) {
+            const __m512d xi = _mm512_loadu_pd(t.x + i);
+            const __m512d yi = _mm512_loadu_pd(t.y + i);
+            __m512d axi = zero;
+            __m512d ayi = zero;
+            for (size_t j = 0; j < s.count; ++j) {
+                const __m512d dx = _mm512_sub_pd(_mm512_set1_pd(s.x[j]), xi);
+                const __m512d dy = _mm512_sub_pd(_mm512_set1_pd(s.y[j]), yi);
+                const __m512d r2 = _mm512_fmadd_pd(dx, dx, _mm512_fmadd_pd(dy, dy, eps2));
+                // 14 bit double estimate, two Newton steps to full precision.
+                const __mmask8 valid = _mm512_cmp_pd_mask(r2, zero, _CMP_GT_OQ);
+                __m512d inv = _mm512_maskz_rsqrt14_pd(valid, r2);
+                const __m512d h = _mm512_mul_pd(half, r2);
+                inv = _mm512_mul_pd(inv, _mm512_fnmadd_pd(h, _mm512_mul_pd(inv, inv), three_halves));
+                inv = _mm512_mul_pd(inv, _mm512_fnmadd_pd(h, _mm512_mul_pd(inv, inv), three_halves));
+                const __m512d inv3 = _mm512_mul_pd(inv, _mm512_mul_pd(inv, inv));
+                const __m512d f = _mm512_mul_pd(_mm512_set1_pd(g * s.m[j]), inv3);
+                axi = _mm512_fmadd_pd(f, dx, axi);
+                ayi = _mm512_fmadd_pd(f, dy, ayi);
+            }
+            if (accumulate) {
+                axi = _mm512_add_pd(axi, _mm512_loadu_pd(t.ax + i));
+                ayi = _mm512_add_pd(ayi, _mm512_loadu_pd(t.ay + i));
+            }
+            _mm512_storeu_pd(t.ax + i, axi);
+            _mm512_storeu_pd(t.ay + i, ayi);
+        }
+        return i;
+    }
+
+    // Range lengths are multiples of the vector width.
+    GRAV_TARGET("avx2,fma")
+    static void MutualAvx2(
+        const KernelBodies & p, const size_t a0, const size_t a1, const size_t b0, const size_t b1,
+        const double & g, const double & eps2_
+    ) {
+        const __m256d eps2 = _mm256_set1_pd(eps2_);
+        const __m256d half = _mm256_set1_pd(0.5);
+        const __m256d three_halves = _mm256_set1_pd(1.5);
+        const __m256d zero = _mm256_setzero_pd();
+        const __m256d gv = _mm256_set1_pd(g);
+
+        for (size_t j = b0; j < b1; j += 4) {
+            double gmj[4];
+            __m256d ajx[4], ajy[4];
+            for (int r = 0; r < 4; ++r) {
+                gmj[r] = g * p.m[j + r];
+                ajx[r] = zero;
+                ajy[r] = zero;
+            }
+            for (size_t i = a0; i < a1; i += 4) {
+                const __m256d xi = _mm256_loadu_pd(p.x + i);
+                const __m256d yi = _mm256_loadu_pd(p.y + i);
+                const __m256d gmi = _mm256_mul_pd(gv, _mm256_loadu_pd(p.m + i));
+                __m256d axi = zero;
+                __m256d ayi = zero;
+                for (int r = 0; r < 4; ++r) {
+                    const __m256d dx = _mm256_sub_pd(_mm256_set1_pd(p.x[j + r]), xi);
+                    const __m256d dy = _mm256_sub_pd(_mm256_set1_pd(p.y[j + r]), yi);
+                    const __m256d r2 = _mm256_fmadd_pd(dx, dx, _mm256_fmadd_pd(dy, dy, eps2));
+                    __m256d inv = _mm256_cvtps_pd(_mm_rsqrt_ps(_mm256_cvtpd_ps(r2)));
+                    const __m256d h = _mm256_mul_pd(half, r2);
+                    inv = _mm256_mul_pd(inv, _mm256_fnmadd_pd(h, _mm256_mul_pd(inv, inv), three_halves));
+                    inv = _mm256_mul_pd(inv, _mm256_fnmadd_pd(h, _mm256_mul_pd(inv, inv), three_halves));
+                    inv = _mm256_and_pd(inv, _mm256_cmp_pd(r2, zero, _CMP_GT_OQ));
+                    const __m256d inv3 = _mm256_mul_pd(inv, _mm256_mul_pd(inv, inv));
+                    const __m256d fi = _mm256_mul_pd(_mm256_set1_pd(gmj[r]), inv3);
+                    const __m256d fj = _mm256_mul_pd(gmi, inv3);
+                    axi = _mm256_fmadd_pd(fi, dx, axi);
+                    ayi = _mm256_fmadd_pd(fi, dy, ayi);
+                    ajx[r] = _mm256_fnmadd_pd(fj, dx, ajx[r]);
+                    ajy[r] = _mm256_fnmadd_pd(fj, dy, ajy[r]);
+                }
+                _mm256_storeu_pd(p.ax + i, _mm256_add_pd(axi, _mm256_loadu_pd(p.ax + i)));
+                _mm256_storeu_pd(p.ay + i, _mm256_add_pd(ayi, _mm256_loadu_pd(p.ay + i)));
+            }
+            for (int r = 0; r < 4; ++r) {
+                p.ax[j + r] += SumAvx2(ajx[r]);
+                p.ay[j + r] += SumAvx2(ajy[r]);
+            }
+        }
+    }
+    GRAV_TARGET("avx2,fma")
+    static double SumAvx2(const __m256d & v) {
+        const __m128d s = _mm_add_pd(_mm256_castpd256_pd128(v), _mm256_extractf128_pd(v, 1));
+        return _mm_cvtsd_f64(_mm_add_sd(s, _mm_unpackhi_pd(s, s)));
+    }
+
+    GRAV_TARGET("avx512f")
+    static void MutualAvx512(
+        const KernelBodies & p, const size_t a0, const size_t a1, const size_t b0, const size_t b1,
+        const double & g, const double & eps2_
+    ) {
+        const __m512d eps2 = _mm512_set1_pd(eps2_);
+        const __m512d half = _mm512_set1_pd(0.5);
+        const __m512d three_halves = _mm512_set1_pd(1.5);
+        const __m512d zero = _mm512_setzero_pd();
+        const __m512d gv = _mm512_set1_pd(g);
+
+        for (size_t j = b0; j < b1; j += 8) {
+            double gmj[8];
+            __m512d ajx[8], ajy[8];
+            for (int r = 0; r < 8; ++r) {
+                gmj[r] = g * p.m[j + r];
+                ajx[r] = zero;
+                ajy[r] = zero;
+            }
+            for (size_t i = a0; i < a1; i += 8) {
+                const __m512d xi = _mm512_loadu_pd(p.x + i);
+                const __m512d yi = _mm512_loadu_pd(p.y + i);
+                const __m512d gmi = _mm512_mul_pd(gv, _mm512_loadu_pd(p.m + i));
+                __m512d axi = zero;
+                __m512d ayi = zero;
+                for (int r = 0; r < 8; ++r) {
+                    const __m512d dx = _mm512_sub_pd(_mm512_set1_pd(p.x[j + r]), xi);
+                    const __m512d dy = _mm512_sub_pd(_mm512_set1_pd(p.y[j + r]), yi);
+                    const __m512d r2 = _mm512_fmadd_pd(dx, dx, _mm512_fmadd_pd(dy, dy, eps2));
+                    const __mmask8 valid = _mm512_cmp_pd_mask(r2, zero, _CMP_GT_OQ);
+                    __m512d inv = _mm512_maskz_rsqrt14_pd(valid, r2);
+                    const __m512d h = _mm512_mul_pd(half, r2);
+                    inv = _mm512_mul_pd(inv, _mm512_fnmadd_pd(h, _mm512_mul_pd(inv, inv), three_halves));
+                    inv = _mm512_mul_pd(inv, _mm512_fnmadd_pd(h, _mm512_mul_pd(inv, inv), three_halves));
+                    const __m512d inv3 = _mm512_mul_pd(inv, _mm512_mul_pd(inv, inv));
+                    const __m512d fi = _mm512_mul_pd(_mm512_set1_pd(gmj[r]), inv3);
+                    const __m512d fj = _mm512_mul_pd(gmi, inv3);
+                    axi = _mm512_fmadd_pd(fi, dx, axi);
+                    ayi = _mm512_fmadd_pd(fi, dy, ayi);
+                    ajx[r] = _mm512_fnmadd_pd(fj, dx, ajx[r]);
+                    ajy[r] = _mm512_fnmadd_pd(fj, dy, ajy[r]);
+                }
+                _mm512_storeu_pd(p.ax + i, _mm512_add_pd(axi, _mm512_loadu_pd(p.ax + i)));
+                _mm512_storeu_pd(p.ay + i, _mm512_add_pd(ayi, _mm512_loadu_pd(p.ay + i)));
+            }
+            for (int r = 0; r < 8; ++r) {
+                p.ax[j + r] += SumAvx512(ajx[r]);
+                p.ay[j + r] += SumAvx512(ajy[r]);
+            }
+        }
+    }
+    // Through memory: GCC's _mm512_reduce_add_pd extracts with an undefined
+    // pass-through that -Wall reports as used uninitialised.
+    GRAV_TARGET("avx512f")
+    static double SumAvx512(const __m512d & v) {
+        alignas(64) double lanes[8];
+        _mm512_store_pd(lanes, v);
+        return ((lanes[0] + lanes[1]) + (lanes[2] + lanes[3])) + ((lanes[4] + lanes[5]) + (lanes[6] + lanes[7]));
+    }
+#endif
+};
+
+#endif // GRAVITY_KERNEL_HPP
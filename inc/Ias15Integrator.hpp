@@ -0,0 +1,465 @@
+#ifndef IAS15_INTEGRATOR_HPP
+#define IAS15_INTEGRATOR_HPP
+
+#include "AlignedArray.hpp"
+#include "Integrator.hpp"
+#include "Logger.hpp"
+
+#include <algorithm>
+
+#include <cmath>
+#include <cstdint>
+
+// 15th order Gauss-Radau integrator after IAS15 (Rein & Spiegel 2015). Over
+// a step the acceleration of each body is a polynomial in the step fraction
+// t,
+//   a(t) = a0 + b0 t + b1 t^2 + ... + b6 t^7,
+// which integrates in closed form to positions and velocities. The b are
+// found by predictor-corrector iteration: positions at the seven non-zero
+// Gauss-Radau nodes follow from the current b, forces there update the
+// Newton form of the polynomial (coefficients g) and through it the b,
+// until the b stop changing. Each sweep costs seven evaluations, one per
+// node, and an accepted step one more for the forces at its end, so a step
+// of k sweeps takes 7k + 1: 15 at two sweeps, 22 at three. The b predicted
+// from the previous step give a good start; two to four sweeps are typical.
+//
+// The step length follows epsilon = max|b6| / max|a| of the last step,
+// dt_new = dt (tolerance / epsilon)^(1/7). A step whose proposed successor
+// is under a quarter of its own length is redone at that length; growth
+// is limited to four times per step. Each Step(dt) is covered exactly, the
+// last internal step cut to fit. Positions and velocities are updated with
+// compensated summation so round-off stays at machine precision over long
+// runs.
+//
+// The nodes are the roots of P7 + P8 on [-1, 1] mapped to [0, 1], and the
+// conversions between g and b are products of those nodes, so all constants
+// are computed once at construction.
+class Ias15Integrator : public Integrator {
+private:
+    enum {
+        k_Order = 7,                 // b0..b6
+        k_MaxIterations = 12,
+    };
+    const double k_Safety = 0.25;
+    // Predictor-corrector convergence, relative to the largest acceleration.
+    const double k_Converged = 1e-16;
+
+    double h_[k_Order + 1];          // nodes, h_[0] = 0
+    double c_[k_Order][k_Order];     // b_k = sum over j >= k of c_[k][j] g_j
+    double d_[k_Order][k_Order];     // g_j = sum over k >= j of d_[j][k] b_k
+    double binomial_[k_Order + 1][k_Order + 1];
+
+    double tolerance_;
+    AdaptiveStepper stepper_;
+    double b_step_;                  // step the b below are scaled for
+    AlignedArray<double> bx_[k_Order], by_[k_Order];
+    AlignedArray<double> gx_[k_Order], gy_[k_Order];
+    AlignedArray<double> x0_, y0_, vx0_, vy0_, ax0_, ay0_;
+    AlignedArray<double> csx_, csy_, csvx_, csvy_;  // compensation terms
+    AlignedArray<double> change_, scale_;           // scratch for maxima
+    uint64_t evaluations_;
+    uint64_t iterations_;
+    bool warned_;
+
+public:
+    Ias15Integrator()
+    : tolerance_(1e-9)
+    , stepper_("Ias15Integrator")
+    , b_step_(0.0)
+    , evaluations_(0)
+    , iterations_(0)
+    , warned_(false)
+    {
+        Nodes();
+        Conversions();
+    }
+    ~Ias15Integrator() {}
+    const char * Name() const override {
+        return "IAS15 (Gauss-Radau)";
+    }
+    // Bound on max|b6| / max|a| per step.
+    void SetTolerance(const double & tolerance) {
+        tolerance_ = tolerance;
+    }
+    double GetTolerance() const {
+        return tolerance_;
+    }
+    // Force evaluations, internal steps and predictor-corrector sweeps since
+    // construction.
+    uint64_t Evaluations() const {
+        return evaluations_;
+    }
+    uint64_t Accepted() const {
+        return stepper_.Accepted();
+    }
+    uint64_t Rejected() const {
+        return stepper_.Rejected();
+    }
+    uint64_t Iterations() const {
+        return iterations_;
+    }
+    // The predicted b and the compensation terms belong to bodies and must
+    // follow them.
+    void Permute(const uint32_t * order, const size_t count) override {
+        if (!valid_ || csx_.Size() != count) {
+            valid_ = false;
+            return;
+        }
+        AlignedArray<double> & tmp = x0_;
+        auto gather = [&](AlignedArray<double> & a) {
+            tmp.Resize(count);
+            for (size_t k = 0; k < count; ++k) {
+                tmp[k] = a[order[k]];
+            }
+            a.Swap(tmp);
+        };
+        for (int k = 0; k < k_Order; ++k) {
+            gather(bx_[k]);
+            gather(by_[k]);
+        }
+        gather(csx_);
+        gather(csy_);
+        gather(csvx_);
+        gather(csvy_);
+    }
+    void Step(Particles & bodies, ForceEngine & engine, const double & dt) override {
+        const size_t n = bodies.Size();
+        if (n == 0 || dt == 0.0) {
+            return;
+        }
+        if (!valid_ || csx_.Size() != n) {
+            Start(bodies, engine);
+        }
+        stepper_.Advance(dt
+            , [&](const double & h, double & next) {
+                Rescale(h);
+                next = Attempt(bodies, engine, h);
+                return fabs(next) >= k_Safety * fabs(h);
+            }
+            , [&]() {
+                Restore(bodies);
+            }
+            , [&](const double & h, const double & next) {
+                Finish(bodies, engine, h, next);
+            }
+        );
+    }
+
+private:
+    static double Legendre(const int n, const double & x) {
+        double p0 = 1.0;
+        double p1 = x;
+        if (n == 0) {
+            return p0;
+        }
+        for (int k = 1; k < n; ++k) {
+            const double p2 = ((2 * k + 1) * x * p1 - k * p0) / (k + 1);
+            p0 = p1;
+            p1 = p2;
+        }
+        return p1;
+    }
+    // Radau nodes: the roots of P7 + P8 other than -1, bracketed on a fine
+    // grid and bisected to the last bit.
+    void Nodes() {
+        auto f = [](const double & x) {
+            return Legendre(k_Order, x) + Legendre(k_Order + 1, x);
+        };
+        const int k_Grid = 4096;
+        int found = 0;
+        h_[found++] = 0.0;
+        for (int i = 1; i < k_Grid && found <= k_Order; ++i) {
+            double lo = -1.0 + 2.0 * i / k_Grid;
+            double hi = -1.0 + 2.0 * (i + 1) / k_Grid;
+            if (f(lo) * f(hi) > 0.0) {
+                continue;
+            }
+            for (int it = 0; it < 200; ++it) {
+                const double mid = 0.5 * (lo + hi);
+                if (mid == lo || mid == hi) {
+                    break;
+                }
+                if (f(lo) * f(mid) <= 0.0) {
+                    hi = mid;
+                } else {
+                    lo = mid;
+                }
+            }
+            h_[found++] = 0.5 * (0.5 * (lo + hi) + 1.0);
+        }
+        if (found != k_Order + 1) {
+            throw CustomException("Ias15Integrator found %d Radau nodes!", found - 1);
+        }
+    }
+    // Expands t (t - h1) ... (t - hj) into powers of t for c_, inverts the
+    // unit triangular c_ for d_, and fills the binomials for prediction.
+    void Conversions() {
+        for (int k = 0; k < k_Order; ++k) {
+            for (int j = 0; j < k_Order; ++j) {
+                c_[k][j] = 0.0;
+                d_[k][j] = 0.0;
+            }
+        }
+        // p holds the coefficients of t^1..t^7 of the current product.
+        double p[k_Order + 1] = { 0.0, 1.0 };
+        for (int j = 0; j < k_Order; ++j) {
+            if (j > 0) {
+                for (int k = j + 1; k >= 1; --k) {
+                    p[k] = p[k - 1] - h_[j] * p[k];
+                }
+                p[0] = 0.0;
+            }
+            for (int k = 0; k <= j; ++k) {
+                c_[k][j] = p[k + 1];
+            }
+        }
+        for (int j = k_Order - 1; j >= 0; --j) {
+            d_[j][j] = 1.0;
+            for (int k = j + 1; k < k_Order; ++k) {
+                double sum = 0.0;
+                for (int m = j + 1; m <= k; ++m) {
+                    sum += c_[j][m] * d_[m][k];
+                }
+                d_[j][k] = -sum;
+            }
+        }
+        for (int i = 0; i <= k_Order; ++i) {
+            binomial_[i][0] = 1.0;
+            for (int k = 1; k <= k_Order; ++k) {
+                binomial_[i][k] = k > i ? 0.0 : binomial_[i - 1][k - 1] + binomial_[i - 1][k];
+            }
+        }
+    }
+    void Start(Particles & bodies, ForceEngine & engine) {
+        const size_t n = bodies.Size();
+        for (int k = 0; k < k_Order; ++k) {
+            for (auto * a : { &bx_[k], &by_[k], &gx_[k], &gy_[k] }) {
+                a->Resize(n);
+                a->Fill(0.0);
+            }
+        }
+        for (auto * a : { &csx_, &csy_, &csvx_, &csvy_ }) {
+            a->Resize(n);
+            a->Fill(0.0);
+        }
+        change_.Resize(n);
+        scale_.Resize(n);
+        b_step_ = 0.0;
+        engine.Compute(bodies);
+        ++evaluations_;
+        valid_ = true;
+    }
+    // Rescales the predicted b from the step they were made for to h; the
+    // polynomial is the same, only t is stretched.
+    void Rescale(const double & h) {
+        if (b_step_ == 0.0 || b_step_ == h) {
+            b_step_ = h;
+            return;
+        }
+        const double q = h / b_step_;
+        double qk[k_Order];
+        qk[0] = q;
+        for (int k = 1; k < k_Order; ++k) {
+            qk[k] = qk[k - 1] * q;
+        }
+        ParallelFor(pool_.get(), 0, csx_.Size(), k_StreamGrain, [&](size_t begin, size_t end) {
+            for (int k = 0; k < k_Order; ++k) {
+                for (size_t i = begin; i < end; ++i) {
+                    bx_[k][i] *= qk[k];
+                    by_[k][i] *= qk[k];
+                }
+            }
+        });
+        b_step_ = h;
+    }
+    // Converges the b for a step of h from the current state and returns
+    // the step the error estimate suggests next. Bodies are left at the
+    // last node.
+    double Attempt(Particles & bodies, ForceEngine & engine, const double & h) {
+        const size_t n = bodies.Size();
+        x0_ = bodies.x;
+        y0_ = bodies.y;
+        vx0_ = bodies.vx;
+        vy0_ = bodies.vy;
+        ax0_ = bodies.ax;
+        ay0_ = bodies.ay;
+
+        ParallelFor(pool_.get(), 0, n, k_StreamGrain, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; ++i) {
+                for (int j = 0; j < k_Order; ++j) {
+                    double gx = 0.0, gy = 0.0;
+                    for (int k = j; k < k_Order; ++k) {
+                        gx += d_[j][k] * bx_[k][i];
+                        gy += d_[j][k] * by_[k][i];
+                    }
+                    gx_[j][i] = gx;
+                    gy_[j][i] = gy;
+                }
+            }
+        });
+
+        double error = 2.0;
+        double error_last = 3.0;
+        for (int iteration = 0; ; ++iteration) {
+            if (error < k_Converged) {
+                break;
+            }
+            if (iteration > 2 && error_last <= error) {
+                // Round-off: further sweeps only shuffle the last bits.
+                break;
+            }
+            if (iteration >= k_MaxIterations) {
+                if (!warned_) {
+                    L_WARN("Ias15Integrator: predictor-corrector did not converge in %d sweeps.", static_cast<int>(k_MaxIterations));
+                    warned_ = true;
+                }
+                break;
+            }
+            error_last = error;
+            ++iterations_;
+            for (int node = 1; node <= k_Order; ++node) {
+                Predict(bodies, h, h_[node]);
+                engine.Compute(bodies);
+                ++evaluations_;
+                Correct(bodies, node);
+            }
+            error = Ratio(change_, scale_);
+        }
+
+        // max|b6| / max|a0| over every component.
+        ParallelFor(pool_.get(), 0, n, k_StreamGrain, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; ++i) {
+                change_[i] = std::max(fabs(bx_[k_Order - 1][i]), fabs(by_[k_Order - 1][i]));
+                scale_[i] = bodies.alive[i] != 0 ? std::max(fabs(ax0_[i]), fabs(ay0_[i])) : 0.0;
+            }
+        });
+        const double epsilon = Ratio(change_, scale_);
+        if (!(epsilon > 0.0)) {
+            return h / k_Safety;
+        }
+        const double next = h * pow(tolerance_ / epsilon, 1.0 / 7.0);
+        return fabs(next) > fabs(h) / k_Safety ? h / k_Safety : next;
+    }
+    // Positions at fraction t of a step of h from the current b.
+    void Predict(Particles & bodies, const double & h, const double & t) {
+        const double th = t * h;
+        const double k_Inv[k_Order] = {
+            1.0 / 6.0, 1.0 / 12.0, 1.0 / 20.0, 1.0 / 30.0, 1.0 / 42.0, 1.0 / 56.0, 1.0 / 72.0,
+        };
+        ParallelFor(pool_.get(), 0, bodies.Size(), k_StreamGrain, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; ++i) {
+                double px = 0.0, py = 0.0;
+                for (int k = k_Order - 1; k >= 0; --k) {
+                    px = t * (px + bx_[k][i] * k_Inv[k]);
+                    py = t * (py + by_[k][i] * k_Inv[k]);
+                }
+                px += 0.5 * ax0_[i];
+                py += 0.5 * ay0_[i];
+                bodies.x[i] = x0_[i] + (th * (vx0_[i] + th * px) - csx_[i]);
+                bodies.y[i] = y0_[i] + (th * (vy0_[i] + th * py) - csy_[i]);
+            }
+        });
+    }
+    // Folds the accelerations just computed at `node` into g and b. Keeps
+    // the change of b6 and the acceleration scale for the convergence test.
+    void Correct(const Particles & bodies, const int node) {
+        const int j = node - 1;
+        const double * hn = h_;
+        ParallelFor(pool_.get(), 0, bodies.Size(), k_StreamGrain, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; ++i) {
+                // Divided differences of a at 0, h1, ..., h_node.
+                double gx = (bodies.ax[i] - ax0_[i]) / hn[node];
+                double gy = (bodies.ay[i] - ay0_[i]) / hn[node];
+                for (int m = 0; m < j; ++m) {
+                    gx = (gx - gx_[m][i]) / (hn[node] - hn[m + 1]);
+                    gy = (gy - gy_[m][i]) / (hn[node] - hn[m + 1]);
+                }
+                const double dx = gx - gx_[j][i];
+                const double dy = gy - gy_[j][i];
+                gx_[j][i] = gx;
+                gy_[j][i] = gy;
+                for (int k = 0; k <= j; ++k) {
+                    bx_[k][i] += c_[k][j] * dx;
+                    by_[k][i] += c_[k][j] * dy;
+                }
+                if (node == k_Order) {
+                    change_[i] = std::max(fabs(dx), fabs(dy));
+                    scale_[i] = bodies.alive[i] != 0 ? std::max(fabs(bodies.ax[i]), fabs(bodies.ay[i])) : 0.0;
+                }
+            }
+        });
+    }
+    // Ends an accepted step: closed-form positions and velocities at t = 1,
+    // accelerations there, and b extrapolated for a next step of `next`:
+    // the same polynomial continued past t = 1 and re-expanded about it.
+    void Finish(Particles & bodies, ForceEngine & engine, const double & h, const double & next) {
+        const size_t n = bodies.Size();
+        const double q = next / h;
+        double qk[k_Order];
+        qk[0] = q;
+        for (int k = 1; k < k_Order; ++k) {
+            qk[k] = qk[k - 1] * q;
+        }
+        ParallelFor(pool_.get(), 0, n, k_StreamGrain, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; ++i) {
+                double px = 0.5 * ax0_[i], py = 0.5 * ay0_[i];
+                double vx = ax0_[i], vy = ay0_[i];
+                for (int k = 0; k < k_Order; ++k) {
+                    px += bx_[k][i] / ((k + 2) * (k + 3));
+                    py += by_[k][i] / ((k + 2) * (k + 3));
+                    vx += bx_[k][i] / (k + 2);
+                    vy += by_[k][i] / (k + 2);
+                }
+                bodies.x[i] = Add(x0_[i], h * (vx0_[i] + h * px), csx_[i]);
+                bodies.y[i] = Add(y0_[i], h * (vy0_[i] + h * py), csy_[i]);
+                bodies.vx[i] = Add(vx0_[i], h * vx, csvx_[i]);
+                bodies.vy[i] = Add(vy0_[i], h * vy, csvy_[i]);
+
+                double ex[k_Order], ey[k_Order];
+                for (int j = 0; j < k_Order; ++j) {
+                    ex[j] = 0.0;
+                    ey[j] = 0.0;
+                    for (int k = j; k < k_Order; ++k) {
+                        ex[j] += binomial_[k + 1][j + 1] * bx_[k][i];
+                        ey[j] += binomial_[k + 1][j + 1] * by_[k][i];
+                    }
+                }
+                for (int j = 0; j < k_Order; ++j) {
+                    bx_[j][i] = qk[j] * ex[j];
+                    by_[j][i] = qk[j] * ey[j];
+                }
+            }
+        });
+        b_step_ = next;
+        engine.Compute(bodies);
+        ++evaluations_;
+    }
+    // Compensated (Kahan) sum: returns sum + add with the lost low bits
+    // carried in c.
+    static double Add(const double & sum, const double & add, double & c) {
+        const double y = add - c;
+        const double t = sum + y;
+        c = (t - sum) - y;
+        return t;
+    }
+    void Restore(Particles & bodies) {
+        bodies.x = x0_;
+        bodies.y = y0_;
+        bodies.vx = vx0_;
+        bodies.vy = vy0_;
+        bodies.ax = ax0_;
+        bodies.ay = ay0_;
+    }
+    // Largest numerator over largest denominator, in index order.
+    static double Ratio(const AlignedArray<double> & num, const AlignedArray<double> & den) {
+        double top = 0.0;
+        double bottom = 0.0;
+        for (size_t i = 0; i < num.Size(); ++i) {
+            top = std::max(top, num[i]);
+            bottom = std::max(bottom, den[i]);
+        }
+        return bottom > 0.0 ? top / bottom : 0.0;
+    }
+};
+
+#endif // IAS15_INTEGRATOR_HPP
@@ -0,0 +1,247 @@
+#ifndef INTEGRATOR_HPP
+#define INTEGRATOR_HPP
+
+#include "ForceEngine.hpp"
+#include "Logger.hpp"
+#include "Particles.hpp"
+#include "ThreadPool.hpp"
+
+#include <memory>
+
+#include <cmath>
+#include <cstdint>
+
+// Runtime handle for the integrators, so the active scheme can be switched
+// from the UI. Accelerations are cached between steps; Invalidate() must be
+// called whenever positions or the force engine change behind its back.
+class Integrator {
+protected:
+    enum {
+        // Bodies per pool chunk for streaming updates: four doubles each,
+        // so one chunk is about an L1 cache worth.
+        k_StreamGrain = 1024,
+    };
+
+    bool valid_;
+    std::shared_ptr<ThreadPool> pool_;
+
+public:
+    Integrator() : valid_(false) {}
+    virtual ~Integrator() {}
+    virtual const char * Name() const = 0;
+    virtual void Step(Particles & bodies, ForceEngine & engine, const double & dt) = 0;
+
+    void Invalidate() {
+        valid_ = false;
+    }
+    // The bodies were reordered with Particles::Permute(order). Integrators
+    // holding per-body state must follow; the default starts afresh.
+    virtual void Permute(const uint32_t * order, const size_t count) {
+        (void)order;
+        (void)count;
+        valid_ = false;
+    }
+    void SetThreadPool(std::shared_ptr<ThreadPool> pool) {
+        pool_ = pool;
+    }
+};
+
+// Internal step control shared by the adaptive integrators: covers one
+// Step(dt) with as many internal steps as the scheme asks for, so rejection,
+// the forced accept and the step-length bookkeeping live in one place.
+class AdaptiveStepper {
+private:
+    // Below this fraction of dt a step is accepted whatever its error, so a
+    // collision cannot stall the run.
+    const double k_MinStep = 1e-12;
+
+    const char * owner_;             // names the integrator in the warning
+    double step_;                    // next step to try, 0 when unknown
+    uint64_t accepted_;
+    uint64_t rejected_;
+    bool warned_;
+
+public:
+    explicit AdaptiveStepper(const char * owner)
+    : owner_(owner)
+    , step_(0.0)
+    , accepted_(0)
+    , rejected_(0)
+    , warned_(false)
+    {}
+    // Internal steps since construction.
+    uint64_t Accepted() const {
+        return accepted_;
+    }
+    uint64_t Rejected() const {
+        return rejected_;
+    }
+    // attempt(h, next) steps h from the current state, sets next to the
+    // step it proposes to follow and returns whether it met the tolerance.
+    // A miss is undone with reject() and retried at next; a hit is committed
+    // with accept(h, next).
+    template<class Attempt, class Reject, class Accept>
+    void Advance(const double & dt, Attempt attempt, Reject reject, Accept accept) {
+        if (step_ == 0.0 || fabs(step_) > fabs(dt)) {
+            step_ = dt;
+        }
+        // Keep the sign of dt so the same code runs backwards.
+        step_ = copysign(step_, dt);
+
+        double t = 0.0;
+        while (fabs(t) < fabs(dt)) {
+            const double remaining = dt - t;
+            const bool last = fabs(step_) >= fabs(remaining);
+            const double h = last ? remaining : step_;
+            double next = h;
+            const bool passed = attempt(h, next);
+            const bool forced = fabs(h) <= k_MinStep * fabs(dt);
+            if (!passed && !forced) {
+                reject();
+                ++rejected_;
+                step_ = next;
+                continue;
+            }
+            if (!passed && !warned_) {
+                L_WARN("%s: accepting a step of dt * %g above tolerance.", owner_, k_MinStep);
+                warned_ = true;
+            }
+            accept(h, next);
+            ++accepted_;
+            t = last ? dt : t + h;
+            // A step cut short to land on dt says nothing about the next one.
+            if (!last || fabs(next) < fabs(step_)) {
+                step_ = next;
+            }
+        }
+    }
+};
+
+// Splitting schemes written as alternating kick/drift stages:
+//   for each stage i: v += kick[i] * dt * a(x); x += drift[i] * dt * v
+// Each policy supplies its stage count and coefficients at compile time.
+template<class Policy>
+class SplittingIntegrator : public Integrator {
+private:
+    double kick_[Policy::k_Stages];
+    double drift_[Policy::k_Stages];
+
+public:
+    SplittingIntegrator() {
+        Policy::Coefficients(kick_, drift_);
+    }
+    ~SplittingIntegrator() {}
+    const char * Name() const override {
+        return Policy::Name();
+    }
+    // Cached accelerations travel with the bodies.
+    void Permute(const uint32_t *, const size_t) override {}
+    void Step(Particles & bodies, ForceEngine & engine, const double & dt) override {
+        for (int s = 0; s < Policy::k_Stages; ++s) {
+            if (kick_[s] != 0.0) {
+                // Accelerations are only recomputed when a drift moved the
+                // bodies, so schemes ending on a kick reuse the last evaluation.
+                if (!valid_) {
+                    engine.Compute(bodies);
+                    valid_ = true;
+                }
+                Kick(bodies, kick_[s] * dt);
+            }
+            if (drift_[s] != 0.0) {
+                Drift(bodies, drift_[s] * dt);
+                valid_ = false;
+            }
+        }
+    }
+
+private:
+    void Kick(Particles & bodies, const double & h) {
+        double * vx = bodies.vx.Data();
+        double * vy = bodies.vy.Data();
+        const double * ax = bodies.ax.Data();
+        const double * ay = bodies.ay.Data();
+        ParallelFor(pool_.get(), 0, bodies.Size(), k_StreamGrain, [=](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; ++i) {
+                vx[i] += ax[i] * h;
+                vy[i] += ay[i] * h;
+            }
+        });
+    }
+    void Drift(Particles & bodies, const double & h) {
+        double * x = bodies.x.Data();
+        double * y = bodies.y.Data();
+        const double * vx = bodies.vx.Data();
+        const double * vy = bodies.vy.Data();
+        ParallelFor(pool_.get(), 0, bodies.Size(), k_StreamGrain, [=](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; ++i) {
+                x[i] += vx[i] * h;
+                y[i] += vy[i] * h;
+            }
+        });
+    }
+};
+
+// Fills kick/drift tables for a symmetric composition of kick-drift-kick
+// leapfrog steps with the given weights, merging adjacent half kicks.
+// Produces count + 1 stages.
+inline void ComposeLeapfrog(const double * weights, const int count, double * kick, double * drift) {
+    kick[0] = 0.5 * weights[0];
+    drift[0] = weights[0];
+    for (int i = 1; i < count; ++i) {
+        kick[i] = 0.5 * (weights[i - 1] + weights[i]);
+        drift[i] = weights[i];
+    }
+    kick[count] = 0.5 * weights[count - 1];
+    drift[count] = 0.0;
+}
+
+// First order, one force evaluation per step. Kick then drift.
+struct SemiImplicitEuler {
+    enum { k_Stages = 1 };
+    static const char * Name() { return "Semi-implicit Euler"; }
+    static void Coefficients(double * kick, double * drift) {
+        kick[0] = 1.0;
+        drift[0] = 1.0;
+    }
+};
+
+// Second order kick-drift-kick, one force evaluation per step.
+struct Leapfrog {
+    enum { k_Stages = 2 };
+    static const char * Name() { return "Leapfrog (KDK)"; }
+    static void Coefficients(double * kick, double * drift) {
+        const double w[1] = { 1.0 };
+        ComposeLeapfrog(w, 1, kick, drift);
+    }
+};
+
+// Fourth order triple-jump composition (Yoshida 1990), three force
+// evaluations per step.
+struct Yoshida4 {
+    enum { k_Stages = 4 };
+    static const char * Name() { return "Yoshida 4th"; }
+    static void Coefficients(double * kick, double * drift) {
+        const double cbrt2 = cbrt(2.0);
+        const double w1 = 1.0 / (2.0 - cbrt2);
+        const double w0 = -cbrt2 / (2.0 - cbrt2);
+        const double w[3] = { w1, w0, w1 };
+        ComposeLeapfrog(w, 3, kick, drift);
+    }
+};
+
+// Sixth order composition, Yoshida 1990 solution A, seven force evaluations
+// per step.
+struct Yoshida6 {
+    enum { k_Stages = 8 };
+    static const char * Name() { return "Yoshida 6th"; }
+    static void Coefficients(double * kick, double * drift) {
+        const double w1 = -1.17767998417887;
+        const double w2 = 0.235573213359357;
+        const double w3 = 0.784513610477560;
+        const double w0 = 1.0 - 2.0 * (w1 + w2 + w3);
+        const double w[7] = { w3, w2, w1, w0, w1, w2, w3 };
+        ComposeLeapfrog(w, 7, kick, drift);
+    }
+};
+
+#endif // INTEGRATOR_HPP
@@ -0,0 +1,225 @@
+#ifndef KEPLER_HPP
+#define KEPLER_HPP
+
+#include "Integrator.hpp"
+#include "Logger.hpp"
+
+#include <atomic>
+
+#include <cmath>
+
+// Stumpff functions c2(z) = (1 - cos sqrt z) / z and c3(z) = (sqrt z - sin sqrt z) / z^1.5,
+// continued analytically to z <= 0 and by series near zero.
+inline void Stumpff(const double & z, double & c2, double & c3) {
+    if (z > 1e-6) {
+        const double s = sqrt(z);
+        c2 = (1.0 - cos(s)) / z;
+        c3 = (s - sin(s)) / (z * s);
+    } else if (z < -1e-6) {
+        const double s = sqrt(-z);
+        c2 = (cosh(s) - 1.0) / -z;
+        c3 = (sinh(s) - s) / (-z * s);
+    } else {
+        c2 = 0.5 - z / 24.0 + z * z / 720.0;
+        c3 = 1.0 / 6.0 - z / 120.0 + z * z / 5040.0;
+    }
+}
+
+// Advances relative position (x, y) and velocity (vx, vy) along the Kepler
+// orbit with gravitational parameter mu by dt, in O(1) for any dt. Uses the
+// universal variable formulation, so bound, parabolic and unbound orbits all
+// take the same path. Returns false if the solver did not converge, in which
+// case the state is left untouched.
+inline bool KeplerPropagate(
+    const double & mu,
+    double & x, double & y,
+    double & vx, double & vy,
+    double dt
+) {
+    enum { k_MaxIterations = 50 };
+
+    const double r0 = sqrt(x * x + y * y);
+    const double v2 = vx * vx + vy * vy;
+    if (r0 <= 0.0 || mu <= 0.0 || dt == 0.0) {
+        return dt == 0.0;
+    }
+    const double sqrt_mu = sqrt(mu);
+    const double sigma0 = (x * vx + y * vy) / sqrt_mu;
+    const double alpha = 2.0 / r0 - v2 / mu;  // 1 / semi-major axis
+
+    // Whole periods of a bound orbit change nothing; drop them first so the
+    // solve stays well conditioned at any time-warp.
+    if (alpha > 0.0) {
+        const double period = 2.0 * 3.14159265358979323846 / (sqrt_mu * alpha * sqrt(alpha));
+        dt = fmod(dt, period);
+    }
+
+    // Starting guess (Vallado): exact for circles, log form for hyperbolas.
+    double chi;
+    if (alpha > 1e-12) {
+        chi = sqrt_mu * dt * alpha;
+    } else if (alpha < -1e-12) {
+        const double a = 1.0 / alpha;
+        const double sign = dt > 0.0 ? 1.0 : -1.0;
+        const double arg = (-2.0 * mu * alpha * dt) /
+            ((x * vx + y * vy) + sign * sqrt(-mu * a) * (1.0 - r0 * alpha));
+        chi = (arg > 0.0) ? sign * sqrt(-a) * log(arg) : sqrt_mu * dt / r0;
+    } else {
+        chi = sqrt_mu * dt / r0;
+    }
+
+    // Laguerre-Conway iteration on the universal Kepler equation; converges
+    // from poor starting points where plain Newton can run away.
+    const double n = 5.0;
+    double c2 = 0.5, c3 = 1.0 / 6.0, r = r0;
+    bool converged = false;
+    for (int k = 0; k < k_MaxIterations; ++k) {
+        const double chi2 = chi * chi;
+        const double z = alpha * chi2;
+        Stumpff(z, c2, c3);
+        const double f = sigma0 * chi2 * c2 + (1.0 - r0 * alpha) * chi2 * chi * c3 + r0 * chi - sqrt_mu * dt;
+        r = sigma0 * chi * (1.0 - z * c3) + (1.0 - r0 * alpha) * chi2 * c2 + r0;
+        const double df2 = sigma0 * (1.0 - z * c2) + (1.0 - r0 * alpha) * chi * (1.0 - z * c3);
+        const double disc = fabs((n - 1.0) * (n - 1.0) * r * r - n * (n - 1.0) * f * df2);
+        const double denom = r + (r >= 0.0 ? 1.0 : -1.0) * sqrt(disc);
+        const double delta = n * f / denom;
+        chi -= delta;
+        if (fabs(delta) <= 1e-14 * (1.0 + fabs(chi))) {
+            converged = true;
+            break;
+        }
+    }
+    if (!converged || !std::isfinite(chi)) {
+        return false;
+    }
+
+    const double chi2 = chi * chi;
+    Stumpff(alpha * chi2, c2, c3);
+    r = sigma0 * chi * (1.0 - alpha * chi2 * c3) + (1.0 - r0 * alpha) * chi2 * c2 + r0;
+
+    // Lagrange coefficients.
+    const double f = 1.0 - chi2 * c2 / r0;
+    const double g = dt - chi2 * chi * c3 / sqrt_mu;
+    const double fdot = sqrt_mu / (r * r0) * chi * (alpha * chi2 * c3 - 1.0);
+    const double gdot = 1.0 - chi2 * c2 / r;
+
+    const double nx = f * x + g * vx;
+    const double ny = f * y + g * vy;
+    const double nvx = fdot * x + gdot * vx;
+    const double nvy = fdot * y + gdot * vy;
+    x = nx;
+    y = ny;
+    vx = nvx;
+    vy = nvy;
+    return true;
+}
+
+// Analytic two-body "integrator": the pair's relative orbit is propagated
+// exactly and the barycentre drifts in a straight line, so any dt is exact.
+// With more bodies every body follows its own Kepler orbit around the
+// heaviest one and mutual perturbations are ignored.
+class KeplerIntegrator : public Integrator {
+private:
+    bool warned_;
+    bool diverged_;
+
+public:
+    KeplerIntegrator() : warned_(false), diverged_(false) {}
+    ~KeplerIntegrator() {}
+    const char * Name() const override {
+        return "Kepler (analytic)";
+    }
+    void Step(Particles & bodies, ForceEngine & engine, const double & dt) override {
+        const double g = engine.GetGravitationalConstant();
+        const size_t central = bodies.Heaviest();
+        if (central >= bodies.Size()) {
+            return;
+        }
+        if (bodies.Alive() == 2) {
+            StepPair(bodies, central, g, dt);
+        } else {
+            if (!warned_ && bodies.Alive() > 2) {
+                L_WARN("KeplerIntegrator: %zu bodies, ignoring all but the central attraction.", bodies.Alive());
+                warned_ = true;
+            }
+            StepCentral(bodies, central, g, dt);
+        }
+        // Accelerations are never evaluated here.
+        valid_ = false;
+    }
+
+private:
+    void StepPair(Particles & b, const size_t c, const double & g, const double & dt) {
+        size_t o = 0;
+        while (o == c || b.alive[o] == 0) {
+            ++o;
+        }
+        const double mc = b.m[c];
+        const double mo = b.m[o];
+        const double mt = mc + mo;
+
+        // Barycentre moves uniformly.
+        double cx = (mc * b.x[c] + mo * b.x[o]) / mt;
+        double cy = (mc * b.y[c] + mo * b.y[o]) / mt;
+        const double cvx = (mc * b.vx[c] + mo * b.vx[o]) / mt;
+        const double cvy = (mc * b.vy[c] + mo * b.vy[o]) / mt;
+        cx += cvx * dt;
+        cy += cvy * dt;
+
+        double rx = b.x[o] - b.x[c];
+        double ry = b.y[o] - b.y[c];
+        double rvx = b.vx[o] - b.vx[c];
+        double rvy = b.vy[o] - b.vy[c];
+        if (!KeplerPropagate(g * mt, rx, ry, rvx, rvy, dt)) {
+            L_WARN("KeplerIntegrator: propagation did not converge.");
+            return;
+        }
+
+        b.x[c] = cx - rx * mo / mt;
+        b.y[c] = cy - ry * mo / mt;
+        b.vx[c] = cvx - rvx * mo / mt;
+        b.vy[c] = cvy - rvy * mo / mt;
+        b.x[o] = cx + rx * mc / mt;
+        b.y[o] = cy + ry * mc / mt;
+        b.vx[o] = cvx + rvx * mc / mt;
+        b.vy[o] = cvy + rvy * mc / mt;
+    }
+    void StepCentral(Particles & b, const size_t c, const double & g, const double & dt) {
+        const double mc = b.m[c];
+        const double xc = b.x[c];
+        const double yc = b.y[c];
+        const double vxc = b.vx[c];
+        const double vyc = b.vy[c];
+        std::atomic<size_t> failed(0);
+        ParallelFor(pool_.get(), 0, b.Size(), k_StreamGrain, [&](size_t begin, size_t end) {
+            size_t count = 0;
+            for (size_t i = begin; i < end; ++i) {
+                if (i == c || b.alive[i] == 0) {
+                    continue;
+                }
+                double rx = b.x[i] - xc;
+                double ry = b.y[i] - yc;
+                double rvx = b.vx[i] - vxc;
+                double rvy = b.vy[i] - vyc;
+                // A failed solve leaves the relative state as it was, so the
+                // body at least keeps pace with the central one.
+                if (!KeplerPropagate(g * (mc + b.m[i]), rx, ry, rvx, rvy, dt)) {
+                    ++count;
+                }
+                b.x[i] = xc + vxc * dt + rx;
+                b.y[i] = yc + vyc * dt + ry;
+                b.vx[i] = vxc + rvx;
+                b.vy[i] = vyc + rvy;
+            }
+            failed += count;
+        });
+        if (failed > 0 && !diverged_) {
+            L_WARN("KeplerIntegrator: propagation did not converge for %zu bodies.", static_cast<size_t>(failed));
+            diverged_ = true;
+        }
+        b.x[c] = xc + vxc * dt;
+        b.y[c] = yc + vyc * dt;
+    }
+};
+
+#endif // KEPLER_HPP
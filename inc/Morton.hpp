@@ -0,0 +1,109 @@
+#ifndef MORTON_HPP
+#define MORTON_HPP
+
+#include "AlignedArray.hpp"
+#include "Particles.hpp"
+#include "ThreadPool.hpp"
+
+#include <algorithm>
+
+#include <cstdint>
+
+// Spreads the low 32 bits of v to the even bits of the result.
+inline uint64_t MortonSpread(const uint32_t v) {
+    uint64_t x = v;
+    x = (x | (x << 16)) & 0x0000FFFF0000FFFFull;
+    x = (x | (x << 8)) & 0x00FF00FF00FF00FFull;
+    x = (x | (x << 4)) & 0x0F0F0F0F0F0F0F0Full;
+    x = (x | (x << 2)) & 0x3333333333333333ull;
+    x = (x | (x << 1)) & 0x5555555555555555ull;
+    return x;
+}
+
+// Inverse of MortonSpread(): gathers the even bits of x.
+inline uint32_t MortonCompact(uint64_t x) {
+    x &= 0x5555555555555555ull;
+    x = (x | (x >> 1)) & 0x3333333333333333ull;
+    x = (x | (x >> 2)) & 0x0F0F0F0F0F0F0F0Full;
+    x = (x | (x >> 4)) & 0x00FF00FF00FF00FFull;
+    x = (x | (x >> 8)) & 0x0000FFFF0000FFFFull;
+    x = (x | (x >> 16)) & 0x00000000FFFFFFFFull;
+    return static_cast<uint32_t>(x);
+}
+
+// Z-order key of quantised coordinates: x on the even bits, y on the odd.
+inline uint64_t MortonKey(const uint32_t qx, const uint32_t qy) {
+    return MortonSpread(qx) | (MortonSpread(qy) << 1);
+}
+
+// Number of leading quadtree levels (2-bit digits) two keys of `levels`
+// levels have in common; `levels` when they are equal.
+inline int MortonCommonLevels(const uint64_t a, const uint64_t b, const int levels) {
+    const uint64_t x = (a ^ b) << (64 - 2 * levels);
+    if (x == 0) {
+        return levels;
+    }
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_clzll(x) / 2;
+#else
+    int zeros = 0;
+    for (uint64_t bit = uint64_t(1) << 63; (x & bit) == 0; bit >>= 1) {
+        ++zeros;
+    }
+    return zeros / 2;
+#endif
+}
+
+// Square that the keys were quantised over.
+struct MortonBox {
+    double min_x;
+    double min_y;
+    double size;
+};
+
+// Keys for every body from positions quantised to `bits` (at most 32) per
+// axis over the bounding square of the live bodies. Keys use the low
+// 2 * bits bits; dead bodies get the all-ones key so they sort after every
+// live one in a full 64-bit sort.
+inline MortonBox MortonKeys(const Particles & bodies, ThreadPool * pool, const int bits, AlignedArray<uint64_t> & keys) {
+    enum { k_Grain = 4096 };
+
+    const size_t n = bodies.Size();
+    MortonBox box = { 0.0, 0.0, 0.0 };
+    double max_x = 0.0, max_y = 0.0;
+    bool first = true;
+    for (size_t i = 0; i < n; ++i) {
+        if (bodies.alive[i] == 0) {
+            continue;
+        }
+        if (first) {
+            box.min_x = max_x = bodies.x[i];
+            box.min_y = max_y = bodies.y[i];
+            first = false;
+        }
+        box.min_x = std::min(box.min_x, bodies.x[i]);
+        max_x = std::max(max_x, bodies.x[i]);
+        box.min_y = std::min(box.min_y, bodies.y[i]);
+        max_y = std::max(max_y, bodies.y[i]);
+    }
+    box.size = std::max(max_x - box.min_x, max_y - box.min_y) * 1.0001 + 1e-9;
+
+    const uint64_t cells = uint64_t(1) << bits;
+    const double scale = cells / box.size;
+    const uint64_t dead = ~uint64_t(0);
+    keys.Resize(n);
+    ParallelFor(pool, 0, n, k_Grain, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            if (bodies.alive[i] == 0) {
+                keys[i] = dead;
+                continue;
+            }
+            const uint64_t qx = std::min(static_cast<uint64_t>((bodies.x[i] - box.min_x) * scale), cells - 1);
+            const uint64_t qy = std::min(static_cast<uint64_t>((bodies.y[i] - box.min_y) * scale), cells - 1);
+            keys[i] = MortonKey(static_cast<uint32_t>(qx), static_cast<uint32_t>(qy));
+        }
+    });
+    return box;
+}
+
+#endif // MORTON_HPP
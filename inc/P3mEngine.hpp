@@ -0,0 +1,213 @@
+#ifndef P3M_ENGINE_HPP
+#define P3M_ENGINE_HPP
+
+#include "AlignedArray.hpp"
+#include "PmEngine.hpp"
+#include "RadixSort.hpp"
+
+#include <algorithm>
+#include <vector>
+
+#include <cmath>
+#include <cstdint>
+
+// Particle-particle particle-mesh solver. The softened 1/S, S^2 = r^2 + eps^2,
+// is split at scale rs into erf(S / 2rs) / S, smooth enough for the mesh, and
+// erfc(S / 2rs) / S, which falls to 1.5e-3 of the whole by the cut-off at
+// 4.5 rs and is summed pair by pair. Close encounters keep their exact force
+// while the mesh carries everything else, so clustered scenes cost about one
+// mesh solve plus the neighbours within a few mesh cells of each body.
+//
+// rs is 1.25 mesh spacings, where cloud-in-cell smoothing of the long part is
+// already small. The short part is the full kernel minus the long part; the
+// long part's factor L(S^2) is smooth and finite at zero, so it is tabulated
+// in S^2 and interpolated linearly, and the pair loop needs one sqrt and no
+// erfc.
+//
+// Pairs are found with a cell list over the mesh extent, cells at least one
+// cut-off wide. Bodies are radix-sorted by cell, row-major, so the three
+// cells of each neighbouring row are one contiguous run and every body scans
+// three runs. Each body sums its own runs in a fixed order, so the result is
+// the same for any split of the bodies across the pool.
+class P3mEngine : public PmEngine {
+private:
+    enum {
+        k_TableSize = 2048,
+    };
+    const double k_Split = 1.25;     // rs in mesh spacings
+    const double k_Cutoff = 4.5;     // short-range reach in rs
+
+    double rs_;
+    double cut2_;                    // squared cut-off in S^2
+    double table_h_, table_eps2_;    // what the table was built for
+    std::vector<double> table_;      // L at S^2 = k / table_scale_
+    double table_scale_;
+
+    size_t cells_;                   // cells per side
+    double cell_;                    // cell width
+    AlignedArray<uint64_t> cell_keys_;
+    AlignedArray<uint32_t> cell_order_;  // sorted position -> body index
+    AlignedArray<uint32_t> cell_start_;  // first sorted body of each cell
+    AlignedArray<double> sx_, sy_, sm_;  // bodies in cell order
+
+public:
+    P3mEngine()
+    : rs_(0.0), cut2_(0.0)
+    , table_h_(0.0), table_eps2_(-1.0), table_scale_(0.0)
+    , cells_(0), cell_(0.0)
+    {}
+    ~P3mEngine() {}
+    const char * Name() const override {
+        return "P3M";
+    }
+    void Compute(Particles & bodies) override {
+        PmEngine::Compute(bodies);
+        Bin(bodies);
+        const size_t live = sx_.Size();
+        ParallelFor(pool_.get(), 0, live, k_Grain, [&](size_t begin, size_t end) {
+            for (size_t k = begin; k < end; ++k) {
+                Short(bodies, cell_order_[k]);
+            }
+        });
+    }
+    void ComputeActive(Particles & bodies, const uint32_t * active, const size_t count) override {
+        PmEngine::ComputeActive(bodies, active, count);
+        Bin(bodies);
+        ParallelFor(pool_.get(), 0, count, k_Grain, [&](size_t begin, size_t end) {
+            for (size_t k = begin; k < end; ++k) {
+                if (bodies.alive[active[k]] != 0) {
+                    Short(bodies, active[k]);
+                }
+            }
+        });
+    }
+
+protected:
+    // Long part only; finite at zero separation, so no cell average.
+    double Green(const double & r2) const override {
+        const double rs = k_Split * h_;
+        const double s2 = r2 + eps2_;
+        if (s2 <= 0.0) {
+            return 1.0 / (sqrt(k_Pi) * rs);
+        }
+        const double s = sqrt(s2);
+        return erf(s / (2.0 * rs)) / s;
+    }
+
+private:
+    const double k_Pi = 3.14159265358979323846;
+
+    // L(S^2) = erf(S / 2rs) / S^3 - exp(-S^2 / 4rs^2) / (rs sqrt(pi) S^2),
+    // the long part's acceleration per unit mass and offset.
+    double Long(const double & s2) const {
+        const double rs = rs_;
+        if (s2 <= 0.0) {
+            return 1.0 / (6.0 * sqrt(k_Pi) * rs * rs * rs);
+        }
+        const double s = sqrt(s2);
+        return erf(s / (2.0 * rs)) / (s2 * s) - exp(-s2 / (4.0 * rs * rs)) / (rs * sqrt(k_Pi) * s2);
+    }
+    void Table() {
+        rs_ = k_Split * h_;
+        const double cut = k_Cutoff * rs_;
+        cut2_ = cut * cut + eps2_;
+        table_.resize(k_TableSize + 1);
+        table_scale_ = k_TableSize / cut2_;
+        for (size_t k = 0; k <= k_TableSize; ++k) {
+            table_[k] = Long(k / table_scale_);
+        }
+        table_h_ = h_;
+        table_eps2_ = eps2_;
+    }
+    // Sorts the live bodies into cells over the mesh extent; the mesh has
+    // just been fitted, so every live body is inside it.
+    void Bin(const Particles & bodies) {
+        if (table_h_ != h_ || table_eps2_ != eps2_) {
+            Table();
+        }
+        ThreadPool * pool = pool_.get();
+        const size_t n = bodies.Size();
+        const double extent = (mesh_ - 1) * h_;
+        cells_ = std::max<size_t>(1, static_cast<size_t>(extent / sqrt(cut2_)));
+        cell_ = extent / cells_;
+        const uint64_t dead = cells_ * cells_;
+
+        cell_keys_.Resize(n);
+        cell_order_.Resize(n);
+        ParallelFor(pool, 0, n, k_Grain, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; ++i) {
+                cell_order_[i] = static_cast<uint32_t>(i);
+                cell_keys_[i] = bodies.alive[i] == 0 ? dead : Key(bodies.x[i], bodies.y[i]);
+            }
+        });
+        int bits = 1;
+        while ((uint64_t(1) << bits) <= dead) {
+            ++bits;
+        }
+        sorter_.Sort(pool, cell_keys_, cell_order_, bits);
+
+        cell_start_.Resize(dead + 1);
+        const uint64_t * keys = cell_keys_.Data();
+        ParallelFor(pool, 0, dead + 1, k_Grain, [&](size_t begin, size_t end) {
+            for (size_t c = begin; c < end; ++c) {
+                cell_start_[c] = static_cast<uint32_t>(std::lower_bound(keys, keys + n, static_cast<uint64_t>(c)) - keys);
+            }
+        });
+        const size_t live = cell_start_[dead];
+        sx_.Resize(live);
+        sy_.Resize(live);
+        sm_.Resize(live);
+        ParallelFor(pool, 0, live, k_Grain, [&](size_t begin, size_t end) {
+            for (size_t k = begin; k < end; ++k) {
+                const uint32_t i = cell_order_[k];
+                sx_[k] = bodies.x[i];
+                sy_[k] = bodies.y[i];
+                sm_[k] = bodies.m[i];
+            }
+        });
+    }
+    uint64_t Key(const double & x, const double & y) const {
+        const size_t cx = std::min(static_cast<size_t>(std::max((x - x0_) / cell_, 0.0)), cells_ - 1);
+        const size_t cy = std::min(static_cast<size_t>(std::max((y - y0_) / cell_, 0.0)), cells_ - 1);
+        return cy * cells_ + cx;
+    }
+    // Adds the short-range pairs within the cut-off to body i.
+    void Short(Particles & bodies, const size_t i) const {
+        const double xi = bodies.x[i];
+        const double yi = bodies.y[i];
+        const uint64_t key = Key(xi, yi);
+        const size_t cx = key % cells_;
+        const size_t cy = key / cells_;
+        const size_t c0 = cx > 0 ? cx - 1 : 0;
+        const size_t c1 = std::min(cx + 1, cells_ - 1);
+        const size_t r0 = cy > 0 ? cy - 1 : 0;
+        const size_t r1 = std::min(cy + 1, cells_ - 1);
+        const double last = static_cast<double>(k_TableSize - 1);
+
+        double ax = 0.0;
+        double ay = 0.0;
+        for (size_t r = r0; r <= r1; ++r) {
+            const size_t end = cell_start_[r * cells_ + c1 + 1];
+            for (size_t k = cell_start_[r * cells_ + c0]; k < end; ++k) {
+                const double dx = sx_[k] - xi;
+                const double dy = sy_[k] - yi;
+                const double r2 = dx * dx + dy * dy;
+                const double s2 = r2 + eps2_;
+                if (r2 <= 0.0 || s2 >= cut2_) {
+                    continue;
+                }
+                const double u = std::min(s2 * table_scale_, last);
+                const size_t t = static_cast<size_t>(u);
+                const double f = u - t;
+                const double inv_s = 1.0 / sqrt(s2);
+                const double factor = inv_s * inv_s * inv_s - (table_[t] + f * (table_[t + 1] - table_[t]));
+                ax += sm_[k] * factor * dx;
+                ay += sm_[k] * factor * dy;
+            }
+        }
+        bodies.ax[i] += g_ * ax;
+        bodies.ay[i] += g_ * ay;
+    }
+};
+
+#endif // P3M_ENGINE_HPP
@@ -0,0 +1,190 @@
+#ifndef PARTICLES_HPP
+#define PARTICLES_HPP
+
+#include "AlignedArray.hpp"
+
+#include <cstdint>
+
+// Structure-of-arrays body store. Every quantity lives in its own aligned,
+// contiguous array so force kernels and integrators stream through memory.
+// Storage order may change (Compact, Permute); ids never do, and Find()
+// maps an id back to its current index.
+struct Particles {
+    typedef AlignedArray<double> Array;
+
+    Array x, y;
+    Array vx, vy;
+    Array ax, ay;
+    Array m;
+    AlignedArray<uint32_t> id;
+    AlignedArray<uint8_t> alive;
+
+private:
+    uint32_t next_id_;
+    size_t removed_;
+    AlignedArray<uint32_t> index_;  // id -> index, k_None once removed
+
+    enum : uint32_t {
+        k_None = 0xFFFFFFFFu,
+    };
+
+public:
+    Particles() : next_id_(0), removed_(0) {}
+
+    size_t Size() const { return x.Size(); }
+    size_t Removed() const { return removed_; }
+    size_t Alive() const { return Size() - removed_; }
+    // One past the largest id handed out so far.
+    uint32_t NextId() const { return next_id_; }
+    // Current index of a body, or Size() if the id is unknown or compacted away.
+    size_t Find(const uint32_t body_id) const {
+        if (body_id >= index_.Size() || index_[body_id] == k_None) {
+            return Size();
+        }
+        return index_[body_id];
+    }
+
+    void Reserve(const size_t count) {
+        x.Reserve(count);
+        y.Reserve(count);
+        vx.Reserve(count);
+        vy.Reserve(count);
+        ax.Reserve(count);
+        ay.Reserve(count);
+        m.Reserve(count);
+        id.Reserve(count);
+        alive.Reserve(count);
+        index_.Reserve(count);
+    }
+    // Appends a body and returns its stable id.
+    uint32_t Add(
+        const double & px, const double & py,
+        const double & pvx, const double & pvy,
+        const double & mass
+    ) {
+        const uint32_t new_id = next_id_++;
+        x.PushBack(px);
+        y.PushBack(py);
+        vx.PushBack(pvx);
+        vy.PushBack(pvy);
+        ax.PushBack(0.0);
+        ay.PushBack(0.0);
+        m.PushBack(mass);
+        id.PushBack(new_id);
+        alive.PushBack(1);
+        index_.PushBack(static_cast<uint32_t>(Size() - 1));
+        return new_id;
+    }
+    // Marks a body as removed. Its mass is zeroed so it stops exerting force
+    // right away; storage is reclaimed by the next Compact().
+    void Remove(const size_t index) {
+        if (index >= Size() || alive[index] == 0) {
+            return;
+        }
+        alive[index] = 0;
+        m[index] = 0.0;
+        index_[id[index]] = k_None;
+        ++removed_;
+    }
+    // Squeezes removed bodies out of the arrays, keeping the survivors' order.
+    void Compact() {
+        if (removed_ == 0) {
+            return;
+        }
+        size_t n = 0;
+        for (size_t i = 0; i < Size(); ++i) {
+            if (alive[i] == 0) {
+                continue;
+            }
+            if (n != i) {
+                x[n] = x[i];
+                y[n] = y[i];
+                vx[n] = vx[i];
+                vy[n] = vy[i];
+                ax[n] = ax[i];
+                ay[n] = ay[i];
+                m[n] = m[i];
+                id[n] = id[i];
+                alive[n] = 1;
+            }
+            ++n;
+        }
+        Resize(n);
+        removed_ = 0;
+        Reindex();
+    }
+    // Reorders the bodies so that new index k holds the body previously at
+    // order[k]; order must be a permutation of [0, Size()).
+    void Permute(const uint32_t * order) {
+        const size_t n = Size();
+        Array scratch;
+        scratch.Resize(n);
+        Gather(x, scratch, order);
+        Gather(y, scratch, order);
+        Gather(vx, scratch, order);
+        Gather(vy, scratch, order);
+        Gather(ax, scratch, order);
+        Gather(ay, scratch, order);
+        Gather(m, scratch, order);
+        AlignedArray<uint32_t> ids;
+        ids.Resize(n);
+        Gather(id, ids, order);
+        AlignedArray<uint8_t> flags;
+        flags.Resize(n);
+        Gather(alive, flags, order);
+        Reindex();
+    }
+    void Clear() {
+        Resize(0);
+        removed_ = 0;
+        next_id_ = 0;
+        index_.Clear();
+    }
+    void ClearAccelerations() {
+        ax.Fill(0.0);
+        ay.Fill(0.0);
+    }
+    // Index of the heaviest body, or Size() if the store is empty.
+    size_t Heaviest() const {
+        size_t heaviest = Size();
+        double mass = -1.0;
+        for (size_t i = 0; i < Size(); ++i) {
+            if (m[i] > mass) {
+                mass = m[i];
+                heaviest = i;
+            }
+        }
+        return heaviest;
+    }
+
+private:
+    template<class T>
+    static void Gather(AlignedArray<T> & a, AlignedArray<T> & scratch, const uint32_t * order) {
+        for (size_t k = 0; k < a.Size(); ++k) {
+            scratch[k] = a[order[k]];
+        }
+        a.Swap(scratch);
+    }
+    void Reindex() {
+        index_.Resize(next_id_);
+        index_.Fill(k_None);
+        for (size_t i = 0; i < Size(); ++i) {
+            if (alive[i] != 0) {
+                index_[id[i]] = static_cast<uint32_t>(i);
+            }
+        }
+    }
+    void Resize(const size_t count) {
+        x.Resize(count);
+        y.Resize(count);
+        vx.Resize(count);
+        vy.Resize(count);
+        ax.Resize(count);
+        ay.Resize(count);
+        m.Resize(count);
+        id.Resize(count);
+        alive.Resize(count);
+    }
+};
+
+#endif // PARTICLES_HPP
@@ -0,0 +1,323 @@
+#ifndef PM_ENGINE_HPP
+#define PM_ENGINE_HPP
+
+#include "AlignedArray.hpp"
+#include "Fft.hpp"
+#include "ForceEngine.hpp"
+#include "RadixSort.hpp"
+
+#include <algorithm>
+
+#include <cmath>
+#include <cstdint>
+
+// Particle-mesh solver, O(N + M^2 log M) for an M x M mesh. Masses are
+// deposited on the mesh nodes with cloud-in-cell weights, convolved with the
+// softened 1/r kernel by FFT, differenced into accelerations at the nodes and
+// interpolated back to the bodies with the same weights. Forces are smooth
+// on scales below a few mesh cells, so this suits disks and other smooth
+// distributions rather than close encounters.
+//
+// Boundaries are isolated: the mesh is zero-padded to 2M x 2M and the kernel
+// is sampled over every offset from -M to M - 1, so the circular convolution
+// equals the open-space sum and nothing wraps around. The kernel's transform
+// only changes with the node spacing or the softening. The mesh therefore
+// keeps its extent, with a margin, while the bodies stay inside and do not
+// shrink to a fraction of it, and the transform is reused between steps.
+//
+// Deposition is parallel without atomics or per-thread meshes: bodies are
+// radix-sorted by mesh row and each chunk of rows gathers the bodies whose
+// clouds reach it, writing only its own rows. Every node sums its bodies in
+// the same order whatever the split.
+class PmEngine : public ForceEngine {
+public:
+    enum {
+        k_MinMesh = 32,
+        k_MaxMesh = 2048,
+    };
+
+protected:
+    enum {
+        k_Grain = 4096,
+        k_RowGrain = 8,
+        // Free nodes at every edge: the cloud reaches one node past the
+        // body and the difference stencil two more.
+        k_Margin = 2,
+    };
+
+    size_t mesh_;
+    double x0_, y0_, h_;                // node (0, 0) and the node spacing
+    Fft fft_;
+    Fft::Grid grid_;                    // padded, 2M x 2M
+    AlignedArray<double> green_;        // kernel transform over (2M)^2
+    double green_h_, green_eps2_;       // what green_ was built for
+    AlignedArray<double> ax_, ay_;      // node accelerations, M x M
+
+    RadixSorter sorter_;
+    AlignedArray<uint64_t> keys_;       // base row of each body
+    AlignedArray<uint32_t> order_;      // bodies by base row
+    AlignedArray<uint32_t> row_start_;  // first of order_ in each base row
+
+public:
+    PmEngine()
+    : mesh_(256)
+    , x0_(0.0), y0_(0.0), h_(0.0)
+    , green_h_(0.0), green_eps2_(-1.0)
+    {}
+    ~PmEngine() {}
+    const char * Name() const override {
+        return "Particle-mesh";
+    }
+    // Nodes per side, a power of two.
+    void SetMesh(const size_t mesh) {
+        size_t m = k_MinMesh;
+        while (m < mesh && m < k_MaxMesh) {
+            m <<= 1;
+        }
+        if (m != mesh_) {
+            mesh_ = m;
+            h_ = 0.0;
+        }
+    }
+    size_t GetMesh() const {
+        return mesh_;
+    }
+    // Node spacing of the last evaluation.
+    double Spacing() const {
+        return h_;
+    }
+    void Compute(Particles & bodies) override {
+        Solve(bodies);
+        ParallelFor(pool_.get(), 0, bodies.Size(), k_Grain, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; ++i) {
+                Interpolate(bodies, i);
+            }
+        });
+    }
+    // The mesh solve is the same; only the listed bodies are interpolated.
+    void ComputeActive(Particles & bodies, const uint32_t * active, const size_t count) override {
+        Solve(bodies);
+        ParallelFor(pool_.get(), 0, count, k_Grain, [&](size_t begin, size_t end) {
+            for (size_t k = begin; k < end; ++k) {
+                Interpolate(bodies, active[k]);
+            }
+        });
+    }
+
+protected:
+    // Interaction sampled on the mesh at squared separation r2. At zero
+    // separation the softened value can be far steeper than the mesh
+    // resolves, so the node takes the mean of 1/r over its own cell,
+    // 4 ln(1 + sqrt 2) / h, when that is smaller.
+    virtual double Green(const double & r2) const {
+        if (r2 <= 0.0) {
+            const double cell = 3.5254943450567646 / h_;
+            return eps2_ > 0.0 ? std::min(1.0 / sqrt(eps2_), cell) : cell;
+        }
+        return 1.0 / sqrt(r2 + eps2_);
+    }
+    // Mesh-smoothed accelerations of every body into the node arrays; the
+    // bodies themselves are not written.
+    void Solve(const Particles & bodies) {
+        ThreadPool * pool = pool_.get();
+        const size_t m = mesh_;
+        const size_t n = 2 * m;
+        fft_.Plan(n);
+        Fit(bodies);
+        if (green_h_ != h_ || green_eps2_ != eps2_ || green_.Size() != n * n) {
+            Transform();
+        }
+
+        grid_.Resize(n * n);
+        ParallelFor(pool, 0, n, k_RowGrain, [&](size_t begin, size_t end) {
+            std::fill(grid_.Data() + begin * n, grid_.Data() + end * n, Fft::Complex(0.0, 0.0));
+        });
+        Deposit(bodies);
+
+        fft_.Forward(pool, grid_, m);
+        ParallelFor(pool, 0, n, k_RowGrain, [&](size_t begin, size_t end) {
+            for (size_t k = begin * n; k < end * n; ++k) {
+                grid_[k] *= green_[k];
+            }
+        });
+        fft_.Inverse(pool, grid_, m);
+
+        // a = G grad phi with phi = sum m / r, by fourth-order central
+        // differences; nodes in the margin are never read.
+        ax_.Resize(m * m);
+        ay_.Resize(m * m);
+        const double scale = g_ / h_;
+        ParallelFor(pool, 0, m, k_RowGrain, [&](size_t begin, size_t end) {
+            for (size_t r = begin; r < end; ++r) {
+                double * ax = ax_.Data() + r * m;
+                double * ay = ay_.Data() + r * m;
+                std::fill(ax, ax + m, 0.0);
+                std::fill(ay, ay + m, 0.0);
+                if (r < k_Margin || r + k_Margin >= m) {
+                    continue;
+                }
+                for (size_t c = k_Margin; c + k_Margin < m; ++c) {
+                    ax[c] = scale * Difference(Phi(r, c + 1), Phi(r, c - 1), Phi(r, c + 2), Phi(r, c - 2));
+                    ay[c] = scale * Difference(Phi(r + 1, c), Phi(r - 1, c), Phi(r + 2, c), Phi(r - 2, c));
+                }
+            }
+        });
+    }
+    // Acceleration of body i from the node accelerations.
+    void Interpolate(Particles & bodies, const size_t i) const {
+        if (bodies.alive[i] == 0) {
+            bodies.ax[i] = 0.0;
+            bodies.ay[i] = 0.0;
+            return;
+        }
+        size_t c, r;
+        double fx, fy;
+        Cloud(bodies.x[i], bodies.y[i], c, r, fx, fy);
+        const size_t k = r * mesh_ + c;
+        const double w00 = (1.0 - fx) * (1.0 - fy);
+        const double w10 = fx * (1.0 - fy);
+        const double w01 = (1.0 - fx) * fy;
+        const double w11 = fx * fy;
+        bodies.ax[i] = w00 * ax_[k] + w10 * ax_[k + 1] + w01 * ax_[k + mesh_] + w11 * ax_[k + mesh_ + 1];
+        bodies.ay[i] = w00 * ay_[k] + w10 * ay_[k + 1] + w01 * ay_[k + mesh_] + w11 * ay_[k + mesh_ + 1];
+    }
+    // Lower-left node of the cloud around (x, y) and the offsets within it.
+    void Cloud(const double & x, const double & y, size_t & c, size_t & r, double & fx, double & fy) const {
+        const double u = (x - x0_) / h_;
+        const double v = (y - y0_) / h_;
+        const double cu = std::floor(u);
+        const double cv = std::floor(v);
+        c = static_cast<size_t>(cu);
+        r = static_cast<size_t>(cv);
+        fx = u - cu;
+        fy = v - cv;
+    }
+
+private:
+    double Phi(const size_t r, const size_t c) const {
+        return grid_[r * 2 * mesh_ + c].real();
+    }
+    static double Difference(const double & p1, const double & m1, const double & p2, const double & m2) {
+        return (2.0 / 3.0) * (p1 - m1) - (1.0 / 12.0) * (p2 - m2);
+    }
+    // Keeps the mesh extent while the live bodies fit inside the margin and
+    // fill at least half of it; otherwise centres a new one on them with a
+    // quarter to spare.
+    void Fit(const Particles & bodies) {
+        double min_x = 0.0, max_x = 0.0, min_y = 0.0, max_y = 0.0;
+        bool first = true;
+        for (size_t i = 0; i < bodies.Size(); ++i) {
+            if (bodies.alive[i] == 0) {
+                continue;
+            }
+            if (first) {
+                min_x = max_x = bodies.x[i];
+                min_y = max_y = bodies.y[i];
+                first = false;
+            }
+            min_x = std::min(min_x, bodies.x[i]);
+            max_x = std::max(max_x, bodies.x[i]);
+            min_y = std::min(min_y, bodies.y[i]);
+            max_y = std::max(max_y, bodies.y[i]);
+        }
+        // Bodies must stay in [k_Margin, mesh_ - 1 - k_Margin) node units.
+        const double usable = static_cast<double>(mesh_ - 1 - 2 * k_Margin);
+        const double size = std::max(max_x - min_x, max_y - min_y);
+        if (h_ > 0.0) {
+            const double lo = k_Margin * h_;
+            const double hi = (mesh_ - 1 - k_Margin) * h_;
+            const bool inside = min_x - x0_ >= lo && max_x - x0_ < hi && min_y - y0_ >= lo && max_y - y0_ < hi;
+            if (inside && size >= 0.5 * usable * h_) {
+                return;
+            }
+        }
+        h_ = std::max(1.25 * size, 1e-9) / usable;
+        const double half = 0.5 * (mesh_ - 1) * h_;
+        x0_ = 0.5 * (min_x + max_x) - half;
+        y0_ = 0.5 * (min_y + max_y) - half;
+    }
+    // Samples Green() over the padded mesh and keeps the real part of its
+    // transform, with the inverse transform's 1 / (2M)^2 folded in. The
+    // kernel is even in both offsets, so the imaginary part vanishes.
+    void Transform() {
+        ThreadPool * pool = pool_.get();
+        const size_t m = mesh_;
+        const size_t n = 2 * m;
+        grid_.Resize(n * n);
+        ParallelFor(pool, 0, n, k_RowGrain, [&](size_t begin, size_t end) {
+            for (size_t r = begin; r < end; ++r) {
+                const double dy = (r < m ? static_cast<double>(r) : static_cast<double>(r) - n) * h_;
+                for (size_t c = 0; c < n; ++c) {
+                    const double dx = (c < m ? static_cast<double>(c) : static_cast<double>(c) - n) * h_;
+                    grid_[r * n + c] = Fft::Complex(Green(dx * dx + dy * dy), 0.0);
+                }
+            }
+        });
+        fft_.Forward(pool, grid_, n);
+        green_.Resize(n * n);
+        const double norm = 1.0 / (static_cast<double>(n) * n);
+        ParallelFor(pool, 0, n, k_RowGrain, [&](size_t begin, size_t end) {
+            for (size_t k = begin * n; k < end * n; ++k) {
+                green_[k] = grid_[k].real() * norm;
+            }
+        });
+        green_h_ = h_;
+        green_eps2_ = eps2_;
+    }
+    void Deposit(const Particles & bodies) {
+        ThreadPool * pool = pool_.get();
+        const size_t count = bodies.Size();
+        const size_t m = mesh_;
+        const size_t n = 2 * m;
+
+        // Dead bodies get row m and sort last.
+        keys_.Resize(count);
+        order_.Resize(count);
+        ParallelFor(pool, 0, count, k_Grain, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; ++i) {
+                order_[i] = static_cast<uint32_t>(i);
+                if (bodies.alive[i] == 0) {
+                    keys_[i] = m;
+                    continue;
+                }
+                size_t c, r;
+                double fx, fy;
+                Cloud(bodies.x[i], bodies.y[i], c, r, fx, fy);
+                keys_[i] = r;
+            }
+        });
+        int bits = 1;
+        while ((size_t(1) << bits) <= m) {
+            ++bits;
+        }
+        sorter_.Sort(pool, keys_, order_, bits);
+        row_start_.Resize(m + 1);
+        for (size_t r = 0; r <= m; ++r) {
+            row_start_[r] = static_cast<uint32_t>(std::lower_bound(keys_.Data(), keys_.Data() + count, static_cast<uint64_t>(r)) - keys_.Data());
+        }
+
+        // Rows [begin, end) take the bodies based on rows begin - 1 .. end - 1.
+        ParallelFor(pool, 0, m, k_RowGrain, [&](size_t begin, size_t end) {
+            const size_t from = row_start_[begin > 0 ? begin - 1 : 0];
+            const size_t to = row_start_[end];
+            for (size_t k = from; k < to; ++k) {
+                const uint32_t i = order_[k];
+                size_t c, r;
+                double fx, fy;
+                Cloud(bodies.x[i], bodies.y[i], c, r, fx, fy);
+                const double mass = bodies.m[i];
+                Fft::Complex * node = grid_.Data() + r * n + c;
+                if (r >= begin) {
+                    node[0] += mass * (1.0 - fx) * (1.0 - fy);
+                    node[1] += mass * fx * (1.0 - fy);
+                }
+                if (r + 1 < end) {
+                    node[n] += mass * (1.0 - fx) * fy;
+                    node[n + 1] += mass * fx * fy;
+                }
+            }
+        });
+    }
+};
+
+#endif // PM_ENGINE_HPP
@@ -0,0 +1,89 @@
+#ifndef RADIX_SORT_HPP
+#define RADIX_SORT_HPP
+
+#include "AlignedArray.hpp"
+#include "ThreadPool.hpp"
+
+#include <algorithm>
+#include <vector>
+
+#include <cstdint>
+
+// Stable LSD radix sort of 64-bit keys carrying 32-bit values, one byte per
+// pass. Each pass histograms fixed blocks of the input in parallel, turns the
+// counts into per-block offsets, then lets every block scatter its own run in
+// order. Block boundaries do not depend on the pool, so the result is the same
+// for any thread count. Passes whose byte is equal across all keys are
+// skipped. Scratch is kept between calls.
+class RadixSorter {
+private:
+    enum {
+        k_Radix = 256,
+        k_Block = 1 << 14,
+    };
+
+    AlignedArray<uint64_t> keys_;
+    AlignedArray<uint32_t> values_;
+    std::vector<uint32_t> counts_;  // [block][digit]
+
+public:
+    RadixSorter() {}
+    ~RadixSorter() {}
+    // Sorts keys ascending and applies the same permutation to values. Only
+    // the low `bits` bits of the keys take part.
+    void Sort(ThreadPool * pool, AlignedArray<uint64_t> & keys, AlignedArray<uint32_t> & values, const int bits = 64) {
+        const size_t n = keys.Size();
+        const size_t blocks = (n + k_Block - 1) / k_Block;
+        keys_.Resize(n);
+        values_.Resize(n);
+        counts_.resize(blocks * k_Radix);
+
+        for (int shift = 0; shift < bits; shift += 8) {
+            ParallelFor(pool, 0, blocks, 1, [&](size_t begin, size_t end) {
+                for (size_t b = begin; b < end; ++b) {
+                    uint32_t * count = &counts_[b * k_Radix];
+                    for (int d = 0; d < k_Radix; ++d) {
+                        count[d] = 0;
+                    }
+                    const size_t last = std::min(n, (b + 1) * k_Block);
+                    for (size_t i = b * k_Block; i < last; ++i) {
+                        ++count[(keys[i] >> shift) & (k_Radix - 1)];
+                    }
+                }
+            });
+
+            // Exclusive scan in digit-major, block-minor order.
+            uint32_t offset = 0;
+            bool trivial = false;
+            for (int d = 0; d < k_Radix; ++d) {
+                uint32_t total = 0;
+                for (size_t b = 0; b < blocks; ++b) {
+                    const uint32_t c = counts_[b * k_Radix + d];
+                    counts_[b * k_Radix + d] = offset;
+                    offset += c;
+                    total += c;
+                }
+                trivial = trivial || total == n;
+            }
+            if (trivial) {
+                continue;
+            }
+
+            ParallelFor(pool, 0, blocks, 1, [&](size_t begin, size_t end) {
+                for (size_t b = begin; b < end; ++b) {
+                    uint32_t * offset = &counts_[b * k_Radix];
+                    const size_t last = std::min(n, (b + 1) * k_Block);
+                    for (size_t i = b * k_Block; i < last; ++i) {
+                        const uint32_t to = offset[(keys[i] >> shift) & (k_Radix - 1)]++;
+                        keys_[to] = keys[i];
+                        values_[to] = values[i];
+                    }
+                }
+            });
+            keys.Swap(keys_);
+            values.Swap(values_);
+        }
+    }
+};
+
+#endif // RADIX_SORT_HPP
@@ -0,0 +1,295 @@
+#ifndef SIM_THREAD_HPP
+#define SIM_THREAD_HPP
+
+#include "Logger.hpp"
+#include "Simulation.hpp"
+#include "TripleBuffer.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <exception>
+
+// What the simulation thread publishes for the front-end once per frame.
+// previous_x/y hold the positions of the frame before, indexed by body id
+// since storage order may change in between, so the renderer can
+// interpolate across the interval that separates the two. Tracers are never
+// reordered, so theirs are kept by index.
+struct SimState {
+    Particles bodies;
+    AlignedArray<double> previous_x;
+    AlignedArray<double> previous_y;
+    AlignedArray<double> tracer_x;
+    AlignedArray<double> tracer_y;
+    AlignedArray<double> previous_tracer_x;
+    AlignedArray<double> previous_tracer_y;
+    std::chrono::steady_clock::time_point stamp;
+    double interval = 0.0;  // real seconds between frames, 0 when unpaced
+    double elapsed = 0.0;
+    uint64_t steps = 0;
+    double step_rate = 0.0;
+    double warp = 0.0;      // achieved simulated days per real second
+    bool limited = false;   // the CPU budget, not the target, set the warp
+    bool diagnosed = false;
+    double energy = 0.0;
+    double energy_error = 0.0;
+};
+
+// Steps a Simulation on its own thread, independent of the render loop, at a
+// target time warp in simulated days per real second. Real time feeds an
+// accumulator of owed simulated time that is paid out in whole fixed steps
+// once per frame, so a slow step or a stall is caught up afterwards instead
+// of slowing simulated time. A governor tracks the cost of a step and caps
+// each frame's steps to a share of the frame, so a target the CPU cannot
+// meet lowers the achieved warp instead of the frame rate. A warp of zero
+// steps as fast as the CPU allows.
+class SimThread {
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    const double k_FrameRate = 60.0;
+    // Share of each frame the steps may use; the rest covers publishing and
+    // keeps the control lock available.
+    const double k_Budget = 0.8;
+    // Most real time (s) the accumulator may owe; beyond that the backlog is
+    // dropped so a long stall does not turn into a burst that stalls again.
+    const double k_MaxBacklog = 0.25;
+
+    std::shared_ptr<Simulation> sim_;
+    std::thread thread_;
+    std::atomic<bool> running_;
+
+    std::mutex control_mutex_;
+    SimSettings settings_;
+    double dt_;
+    double warp_;
+    bool configure_;
+    bool reset_;
+    int reset_scene_;
+    int reset_count_;
+
+    TripleBuffer<SimState> states_;
+    AlignedArray<double> previous_x_;
+    AlignedArray<double> previous_y_;
+    AlignedArray<double> previous_tracer_x_;
+    AlignedArray<double> previous_tracer_y_;
+    double step_cost_;  // smoothed real seconds per step
+    bool diagnosed_;
+    Diagnostics diagnostics_;
+    double energy_error_;
+
+public:
+    explicit SimThread(std::shared_ptr<Simulation> sim)
+    : sim_(sim)
+    , running_(false)
+    , dt_(0.0)
+    , warp_(0.1)
+    , configure_(false)
+    , reset_(false)
+    , reset_scene_(Simulation::scene__SOLAR)
+    , reset_count_(0)
+    , step_cost_(0.0)
+    , diagnosed_(false)
+    , energy_error_(0.0)
+    {}
+    ~SimThread() {
+        Stop();
+    }
+    void Start() {
+        if (running_) {
+            return;
+        }
+        Diagnose();
+        KeepPrevious();
+        Publish(0.0, 0.0, 0.0, false);
+        running_ = true;
+        thread_ = std::thread(&SimThread::Loop, this);
+    }
+    void Stop() {
+        running_ = false;
+        if (thread_.joinable()) {
+            thread_.join();
+        }
+    }
+    void SetTimeStep(const double & dt) {
+        std::lock_guard<std::mutex> lock(control_mutex_);
+        dt_ = dt;
+    }
+    // Target simulated days per real second, 0 for unlimited.
+    void SetWarp(const double & days_per_second) {
+        std::lock_guard<std::mutex> lock(control_mutex_);
+        warp_ = days_per_second;
+    }
+    void Configure(const SimSettings & settings) {
+        std::lock_guard<std::mutex> lock(control_mutex_);
+        settings_ = settings;
+        configure_ = true;
+    }
+    void RequestReset(const int scene, const int count) {
+        std::lock_guard<std::mutex> lock(control_mutex_);
+        reset_ = true;
+        reset_scene_ = scene;
+        reset_count_ = count;
+    }
+    // Latest published state. Reader side only; the reference stays valid
+    // until the next call.
+    const SimState & ReadState() {
+        states_.Update();
+        return states_.Front();
+    }
+
+private:
+    void Loop() {
+        const double frame = 1.0 / k_FrameRate;
+        auto last = Clock::now();
+        auto next = last;
+        auto window_start = last;
+        double window_days = sim_->Elapsed();
+        uint64_t window_steps = 0;
+        bool window_limited = false;
+        double step_rate = 0.0;
+        double achieved = 0.0;
+        bool limited = false;
+        double accumulator = 0.0;  // owed simulated days
+
+        try {
+            while (running_) {
+                // Requests are copied out under the lock and carried out
+                // after it, so the render thread never waits on a rebuild.
+                double dt, warp;
+                bool configure, reset;
+                SimSettings settings;
+                int reset_scene, reset_count;
+                {
+                    std::lock_guard<std::mutex> lock(control_mutex_);
+                    configure = configure_;
+                    reset = reset_;
+                    settings = settings_;
+                    reset_scene = reset_scene_;
+                    reset_count = reset_count_;
+                    configure_ = false;
+                    reset_ = false;
+                    dt = dt_;
+                    warp = warp_;
+                }
+                if (configure) {
+                    sim_->Configure(settings);
+                    // A new engine or integrator has its own cost.
+                    step_cost_ = 0.0;
+                }
+                if (reset) {
+                    sim_->Reset(reset_scene, reset_count);
+                    step_cost_ = 0.0;
+                    window_days = sim_->Elapsed();
+                    Diagnose();
+                }
+
+                auto now = Clock::now();
+                const double real = std::chrono::duration<double>(now - last).count();
+                last = now;
+
+                // What the budget allows; one step when the cost is unknown.
+                const uint64_t affordable = step_cost_ > 0.0
+                    ? std::max<uint64_t>(1, static_cast<uint64_t>(k_Budget * frame / step_cost_))
+                    : 1;
+                uint64_t steps = affordable;
+                const double step_days = sim_->StepDays(dt);
+                if (warp > 0.0 && step_days > 0.0) {
+                    accumulator = std::min(accumulator + real * warp, k_MaxBacklog * warp);
+                    const uint64_t wanted = static_cast<uint64_t>(accumulator / step_days);
+                    // Out of budget, run what fits; the rest stays owed up
+                    // to the backlog cap, which bounds a sustained deficit.
+                    steps = std::min(wanted, affordable);
+                    accumulator -= steps * step_days;
+                    if (wanted > affordable && step_cost_ > 0.0) {
+                        window_limited = true;
+                    }
+                } else {
+                    accumulator = 0.0;
+                }
+
+                if (steps > 0) {
+                    KeepPrevious();
+                    const auto begin = Clock::now();
+                    for (uint64_t s = 0; s < steps; ++s) {
+                        sim_->Step(dt);
+                    }
+                    const double cost = std::chrono::duration<double>(Clock::now() - begin).count() / steps;
+                    step_cost_ = step_cost_ > 0.0 ? 0.8 * step_cost_ + 0.2 * cost : cost;
+                    window_steps += steps;
+                }
+
+                now = Clock::now();
+                const double window = std::chrono::duration<double>(now - window_start).count();
+                if (window >= 0.5) {
+                    step_rate = window_steps / window;
+                    achieved = (sim_->Elapsed() - window_days) / window;
+                    limited = window_limited;
+                    window_steps = 0;
+                    window_days = sim_->Elapsed();
+                    window_limited = false;
+                    window_start = now;
+                    Diagnose();
+                }
+                if (steps > 0) {
+                    Publish(step_rate, achieved, warp > 0.0 ? frame : 0.0, limited);
+                }
+
+                if (warp > 0.0) {
+                    next += std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(frame));
+                    if (next < now) {
+                        next = now;
+                    }
+                    std::this_thread::sleep_until(next);
+                } else {
+                    next = now;
+                }
+            }
+        }
+        catch (std::exception & e) {
+            L_ERROR("SimThread stopped: %s", e.what());
+            running_ = false;
+        }
+    }
+    void KeepPrevious() {
+        const Particles & bodies = sim_->Bodies();
+        previous_x_.Resize(bodies.NextId());
+        previous_y_.Resize(bodies.NextId());
+        for (size_t i = 0; i < bodies.Size(); ++i) {
+            previous_x_[bodies.id[i]] = bodies.x[i];
+            previous_y_[bodies.id[i]] = bodies.y[i];
+        }
+        const Tracers & tracers = sim_->TestParticles();
+        previous_tracer_x_ = tracers.x;
+        previous_tracer_y_ = tracers.y;
+    }
+    void Publish(const double & step_rate, const double & warp, const double & interval, const bool limited) {
+        SimState & state = states_.Back();
+        state.bodies = sim_->Bodies();
+        state.previous_x = previous_x_;
+        state.previous_y = previous_y_;
+        state.tracer_x = sim_->TestParticles().x;
+        state.tracer_y = sim_->TestParticles().y;
+        state.previous_tracer_x = previous_tracer_x_;
+        state.previous_tracer_y = previous_tracer_y_;
+        state.stamp = Clock::now();
+        state.interval = interval;
+        state.elapsed = sim_->Elapsed();
+        state.steps = sim_->Steps();
+        state.step_rate = step_rate;
+        state.warp = warp;
+        state.limited = limited;
+        state.diagnosed = diagnosed_;
+        state.energy = diagnostics_.Energy();
+        state.energy_error = energy_error_;
+        states_.Publish();
+    }
+    void Diagnose() {
+        diagnosed_ = sim_->Diagnose(diagnostics_, energy_error_);
+    }
+};
+
+#endif // SIM_THREAD_HPP
@@ -0,0 +1,133 @@
+#ifndef SIMD_DIRECT_ENGINE_HPP
+#define SIMD_DIRECT_ENGINE_HPP
+
+#include "AlignedArray.hpp"
+#include "ForceEngine.hpp"
+#include "GravityKernel.hpp"
+#include "Logger.hpp"
+
+#include <algorithm>
+#include <vector>
+
+// All-pairs summation on the vectorised GravityKernel. Each pair is evaluated
+// once and applied to both bodies. Bodies are cut into blocks; pool chunks
+// first take the pairs within each block, then a round-robin schedule of
+// rounds in which every block meets one other, so concurrent chunks never
+// write the same body. Every body sums its pairs in the same order whatever
+// the thread count, so results do not depend on it.
+class SimdDirectEngine : public ForceEngine {
+private:
+    enum {
+        // Targets per pool chunk; a multiple of every vector width.
+        k_Grain = 128,
+        // Smallest block, and the most blocks; a multiple of every vector
+        // width. Larger blocks amortise the per-tile reductions, more blocks
+        // give the pool work to spread.
+        k_Block = 256,
+        k_MaxBlocks = 128,
+    };
+
+    GravityKernel kernel_;
+    // Block pairs, round after round; see Schedule().
+    std::vector<size_t> pairs_;
+    size_t blocks_;
+    // Gathered active targets for ComputeActive().
+    AlignedArray<double> tx_, ty_, tax_, tay_;
+
+public:
+    SimdDirectEngine() : blocks_(0) {
+        L_INFO("SimdDirectEngine using %s.", GravityKernel::IsaName(kernel_.GetIsa()));
+    }
+    ~SimdDirectEngine() {}
+    const char * Name() const override {
+        switch (kernel_.GetIsa()) {
+        case GravityKernel::isa__AVX512: return "Direct SIMD (AVX-512)";
+        case GravityKernel::isa__AVX2: return "Direct SIMD (AVX2)";
+        default: return "Direct SIMD (scalar)";
+        }
+    }
+    // See GravityKernel::SetIsa().
+    void SetIsa(const int isa) {
+        kernel_.SetIsa(isa);
+    }
+    int GetIsa() const {
+        return kernel_.GetIsa();
+    }
+    void Compute(Particles & bodies) override {
+        const size_t n = bodies.Size();
+        bodies.ClearAccelerations();
+        size_t block = (n + k_MaxBlocks - 1) / k_MaxBlocks;
+        block = block < k_Block ? static_cast<size_t>(k_Block) : (block + k_Block - 1) / k_Block * k_Block;
+        Schedule((n + block - 1) / block);
+        const KernelBodies p = { bodies.x.Data(), bodies.y.Data(), bodies.m.Data(), bodies.ax.Data(), bodies.ay.Data() };
+        ParallelFor(pool_.get(), 0, blocks_, 1, [&](size_t begin, size_t end) {
+            for (size_t b = begin; b < end; ++b) {
+                kernel_.EvaluateMutual(p, b * block, std::min((b + 1) * block, n), g_, eps2_);
+            }
+        });
+        const size_t per_round = blocks_ / 2;
+        for (size_t round = 0; per_round > 0 && round * per_round < pairs_.size() / 2; ++round) {
+            const size_t * pairs = pairs_.data() + 2 * round * per_round;
+            ParallelFor(pool_.get(), 0, per_round, 1, [&](size_t begin, size_t end) {
+                for (size_t k = begin; k < end; ++k) {
+                    const size_t a = pairs[2 * k];
+                    const size_t b = pairs[2 * k + 1];
+                    kernel_.EvaluateMutual(
+                        p, a * block, std::min((a + 1) * block, n), b * block, std::min((b + 1) * block, n), g_, eps2_
+                    );
+                }
+            });
+        }
+    }
+    // Active targets are packed into contiguous scratch so the kernel still
+    // streams full vectors, then scattered back.
+    void ComputeActive(Particles & bodies, const uint32_t * active, const size_t count) override {
+        tx_.Resize(count);
+        ty_.Resize(count);
+        tax_.Resize(count);
+        tay_.Resize(count);
+        for (size_t k = 0; k < count; ++k) {
+            tx_[k] = bodies.x[active[k]];
+            ty_[k] = bodies.y[active[k]];
+        }
+        const KernelTargets targets = { tx_.Data(), ty_.Data(), tax_.Data(), tay_.Data() };
+        const KernelSources sources = Sources(bodies);
+        ParallelFor(pool_.get(), 0, count, k_Grain, [&](size_t begin, size_t end) {
+            kernel_.Evaluate(targets, begin, end, sources, g_, eps2_);
+        });
+        for (size_t k = 0; k < count; ++k) {
+            bodies.ax[active[k]] = tax_[k];
+            bodies.ay[active[k]] = tay_[k];
+        }
+    }
+private:
+    // Round-robin pairing of the blocks (the circle method): the last slot
+    // stays put while the others rotate by one each round, so every round
+    // holds disjoint pairs and every pair appears once. An odd count gets a
+    // dummy slot, and the block drawn against it sits the round out.
+    void Schedule(const size_t blocks) {
+        if (blocks == blocks_) {
+            return;
+        }
+        blocks_ = blocks;
+        pairs_.clear();
+        const size_t slots = blocks + (blocks & 1);
+        const size_t turn = slots - 1;
+        for (size_t round = 0; round < turn; ++round) {
+            for (size_t k = 0; k < slots / 2; ++k) {
+                const size_t a = k == 0 ? turn : (round + k) % turn;
+                const size_t b = (round + turn - k) % turn;
+                if (a < blocks && b < blocks) {
+                    pairs_.push_back(a);
+                    pairs_.push_back(b);
+                }
+            }
+        }
+    }
+    static KernelSources Sources(const Particles & bodies) {
+        const KernelSources sources = { bodies.x.Data(), bodies.y.Data(), bodies.m.Data(), bodies.Size() };
+        return sources;
+    }
+};
+
+#endif // SIMD_DIRECT_ENGINE_HPP
@@ -0,0 +1,400 @@
+#ifndef SIMULATION_HPP
+#define SIMULATION_HPP
+
+#include "Particles.hpp"
+#include "Tracers.hpp"
+#include "ThreadPool.hpp"
+#include "AccuracyReport.hpp"
+#include "Diagnostics.hpp"
+#include "Ensemble.hpp"
+#include "Morton.hpp"
+#include "RadixSort.hpp"
+#include "DirectEngine.hpp"
+#include "SimdDirectEngine.hpp"
+#include "BarnesHutEngine.hpp"
+#include "FmmEngine.hpp"
+#include "PmEngine.hpp"
+#include "P3mEngine.hpp"
+#include "Integrator.hpp"
+#include "Kepler.hpp"
+#include "WisdomHolman.hpp"
+#include "BlockStepIntegrator.hpp"
+#include "AdaptiveIntegrator.hpp"
+#include "Ias15Integrator.hpp"
+
+#include <algorithm>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+#include <cmath>
+#include <cstdio>
+
+// Knobs the front-end may change while the simulation runs.
+struct SimSettings {
+    int engine = 0;
+    int integrator = 0;
+    double theta = 0.5;
+    int moments = BarnesHutEngine::moments__MONOPOLE;
+    int group = 64;
+    int order = 6;
+    int mesh = 256;
+    double tolerance = 1e-9;
+};
+
+// Physics core: bodies, force engines and integrators. Knows nothing about
+// windows or OpenGL, so it can be stepped from any thread or front-end.
+class Simulation {
+public:
+    enum {
+        scene__SOLAR = 0,
+        scene__DISK,
+        scene__BELT,
+    };
+
+private:
+    enum {
+        // Above this the O(N^2) energy check costs more than it tells.
+        k_MaxDiagnosticBodies = 20000,
+        // Bodies drift out of Z-order slowly; re-sorting every few dozen
+        // steps keeps spatial neighbours close in memory for a few percent
+        // of a step's cost. Small systems fit in cache anyway.
+        k_ReorderInterval = 32,
+        k_ReorderMinimum = 1024,
+        k_ReorderBits = 16,
+    };
+
+    const double k_SunMass = 1.98855e30;
+    const double k_EarthMass = 5.9722e24;
+    const double k_GravitationalConstant = 6.67408e-11;
+    const double k_AstronomicalUnit = 1.49598e11;
+    const double k_EarthOrbitalSpeed = 2.9783e4;
+    const double k_Pi = 3.14159265358979323846;
+    const double k_Rad2Deg = 180.0 / k_Pi;
+    const double k_Deg2Rad = k_Pi / 180.0;
+
+    const double cDistanceFactor = 0.0001;
+    const double cMassFactor = k_GravitationalConstant * 1e-6;
+    const double cSpeedFactor = 0.01;
+    const double cT = cDistanceFactor / cSpeedFactor;
+
+    const double dt = cT;
+    const double c_SunMass = k_SunMass * cMassFactor * cSpeedFactor * cSpeedFactor * cDistanceFactor;
+    const double c_EarthMass = k_EarthMass * cMassFactor * cSpeedFactor * cSpeedFactor * cDistanceFactor;
+    const double c_GravitationalConstant = k_GravitationalConstant / cMassFactor;
+    const double c_AstronomicalUnit = k_AstronomicalUnit * cDistanceFactor;
+    const double c_EarthOrbitalSpeed = k_EarthOrbitalSpeed * cSpeedFactor;
+
+    Particles bodies_;
+    Tracers tracers_;
+    double elapsed_;
+    uint64_t steps_;
+    double energy0_;
+    AlignedArray<double> scratch_;
+    RadixSorter sorter_;
+    AlignedArray<uint64_t> keys_;
+    AlignedArray<uint32_t> order_;
+
+    std::shared_ptr<ThreadPool> pool_;
+    std::vector<std::shared_ptr<ForceEngine>> engines_;
+    std::shared_ptr<BarnesHutEngine> tree_;
+    std::shared_ptr<FmmEngine> fmm_;
+    std::shared_ptr<PmEngine> pm_;
+    std::shared_ptr<P3mEngine> p3m_;
+    std::shared_ptr<ForceEngine> engine_;
+    std::vector<std::shared_ptr<Integrator>> integrators_;
+    std::shared_ptr<DormandPrinceIntegrator> adaptive_;
+    std::shared_ptr<Ias15Integrator> ias15_;
+    std::shared_ptr<Integrator> integrator_;
+
+public:
+    Simulation() : elapsed_(0.0), steps_(0), energy0_(0.0) {}
+    ~Simulation() {}
+    // threads == 0 uses every hardware thread; pin binds workers to cores.
+    void Init(const size_t threads = 0, const bool pin = false) {
+        pool_ = std::make_shared<ThreadPool>(threads, pin);
+        InitEngines();
+        InitIntegrators();
+        Reset(scene__SOLAR, 0);
+    }
+    void Step(const double& dt) {
+        if (bodies_.Size() >= k_ReorderMinimum && steps_ % k_ReorderInterval == 0) {
+            Reorder();
+        }
+        // Tracers bracket the massive step so they see the fields at both
+        // of its ends.
+        tracers_.Begin(pool_.get(), bodies_, c_GravitationalConstant, engine_->GetSoftening2(), dt);
+        integrator_->Step(bodies_, *engine_, dt);
+        tracers_.End(pool_.get(), bodies_, c_GravitationalConstant, engine_->GetSoftening2(), dt);
+        elapsed_ += StepDays(dt);
+        ++steps_;
+    }
+    void Configure(const SimSettings& settings) {
+        // Cached accelerations go stale whenever the force model changes.
+        bool stale = false;
+
+        const size_t engine = static_cast<size_t>(settings.engine);
+        if (engine < engines_.size() && engines_[engine] != engine_) {
+            engine_ = engines_[engine];
+            stale = true;
+        }
+        const size_t integrator = static_cast<size_t>(settings.integrator);
+        if (integrator < integrators_.size() && integrators_[integrator] != integrator_) {
+            integrator_ = integrators_[integrator];
+            stale = true;
+        }
+        if (tree_->GetTheta() != settings.theta) {
+            tree_->SetTheta(settings.theta);
+            stale = true;
+        }
+        if (tree_->GetMoments() != settings.moments) {
+            tree_->SetMoments(settings.moments);
+            stale = true;
+        }
+        if (tree_->GetGroupSize() != static_cast<size_t>(std::max(settings.group, 0))) {
+            tree_->SetGroupSize(static_cast<size_t>(std::max(settings.group, 0)));
+            stale = true;
+        }
+        if (fmm_->GetOrder() != settings.order) {
+            fmm_->SetOrder(settings.order);
+            stale = true;
+        }
+        if (pm_->GetMesh() != static_cast<size_t>(settings.mesh)) {
+            pm_->SetMesh(static_cast<size_t>(settings.mesh));
+            p3m_->SetMesh(static_cast<size_t>(settings.mesh));
+            stale = true;
+        }
+        // Only the step size follows the tolerance; nothing cached goes stale.
+        if (adaptive_->GetTolerance() != settings.tolerance) {
+            adaptive_->SetTolerance(settings.tolerance);
+        }
+        if (ias15_->GetTolerance() != settings.tolerance) {
+            ias15_->SetTolerance(settings.tolerance);
+        }
+        if (stale) {
+            integrator_->Invalidate();
+        }
+    }
+    void Reset(const int scene, const int count) {
+        tracers_.Clear();
+        if (scene == scene__DISK) {
+            InitDisk(count);
+        } else if (scene == scene__BELT) {
+            InitBelt(count);
+        } else {
+            InitSolar();
+        }
+        elapsed_ = 0.0;
+        steps_ = 0;
+        energy0_ = 0.0;
+        integrator_->Invalidate();
+    }
+    // Returns false when the system is too large to check cheaply.
+    bool Diagnose(Diagnostics & d, double & energy_error) {
+        if (bodies_.Size() > k_MaxDiagnosticBodies) {
+            return false;
+        }
+        d = ::Diagnose(bodies_, c_GravitationalConstant, engine_->GetSoftening2(), pool_.get(), scratch_);
+        if (energy0_ == 0.0) {
+            energy0_ = d.Energy();
+        }
+        energy_error = (energy0_ != 0.0) ? (d.Energy() - energy0_) / fabs(energy0_) : 0.0;
+        return true;
+    }
+    // Simulated days covered by one step of dt.
+    double StepDays(const double & dt) const {
+        return dt / (cT * 3600.0 * 24);
+    }
+    // Step used by both front-ends unless told otherwise, about 146 s of
+    // real time per step.
+    static double DefaultTimeStep() {
+        return 10.0 * 131.1 / 900.0;
+    }
+    const Particles & Bodies() const {
+        return bodies_;
+    }
+    const Tracers & TestParticles() const {
+        return tracers_;
+    }
+    // Simulated time in days.
+    double Elapsed() const {
+        return elapsed_;
+    }
+    uint64_t Steps() const {
+        return steps_;
+    }
+    double DefaultTheta() const {
+        return tree_->GetTheta();
+    }
+    // Barnes-Hut error and cost over theta and moment order for the current
+    // bodies, against the SIMD direct engine.
+    void ReportTreeAccuracy(FILE * out) {
+        TreeAccuracyReport(bodies_, *tree_, *engines_[1], out);
+    }
+    // FMM error and cost over expansion order, the same way.
+    void ReportFmmAccuracy(FILE * out) {
+        FmmAccuracyReport(bodies_, *fmm_, *engines_[1], out);
+    }
+    // Particle-mesh and P3M error and cost over mesh size, the same way.
+    void ReportMeshAccuracy(FILE * out) {
+        MeshAccuracyReport(bodies_, *pm_, *engines_[1], out);
+        MeshAccuracyReport(bodies_, *p3m_, *engines_[1], out);
+    }
+    // Sun-Earth pairs for an ensemble sweep: member k of n starts Earth at
+    // 1 AU with 0.25 + 1.5 k / n times the circular speed, which covers
+    // plunging, bound and escaping orbits. Members stop once Earth passes
+    // within 0.05 AU of the Sun or 20 AU from the barycentre.
+    void InitEnsemble(Ensemble & ensemble, const size_t members) const {
+        ensemble.Init(2, members);
+        ensemble.SetGravitationalConstant(c_GravitationalConstant);
+        ensemble.SetSoftening(0.0);
+        ensemble.SetLimits(20.0 * c_AstronomicalUnit, 0.05 * c_AstronomicalUnit);
+        ensemble.SetThreadPool(pool_);
+        const double circular = sqrt(c_GravitationalConstant * (c_SunMass + c_EarthMass) / c_AstronomicalUnit);
+        for (size_t k = 0; k < members; ++k) {
+            const double v = circular * (0.25 + 1.5 * k / members);
+            ensemble.Set(k, 0, 0.0, 0.0, 0.0, v * c_EarthMass / c_SunMass, c_SunMass);
+            ensemble.Set(k, 1, c_AstronomicalUnit, 0.0, 0.0, -v, c_EarthMass);
+        }
+    }
+    std::vector<std::string> EngineNames() const {
+        std::vector<std::string> names;
+        for (auto & e : engines_) {
+            names.push_back(e->Name());
+        }
+        return names;
+    }
+    std::vector<std::string> IntegratorNames() const {
+        std::vector<std::string> names;
+        for (auto & i : integrators_) {
+            names.push_back(i->Name());
+        }
+        return names;
+    }
+
+private:
+    // Sorts the bodies along the Z-order curve so that every spatial kernel
+    // finds its neighbours in nearby memory. Ids are unaffected.
+    void Reorder() {
+        const size_t n = bodies_.Size();
+        MortonKeys(bodies_, pool_.get(), k_ReorderBits, keys_);
+        order_.Resize(n);
+        for (size_t i = 0; i < n; ++i) {
+            order_[i] = static_cast<uint32_t>(i);
+        }
+        sorter_.Sort(pool_.get(), keys_, order_, 2 * k_ReorderBits);
+        bodies_.Permute(order_.Data());
+        integrator_->Permute(order_.Data(), n);
+    }
+    void InitEngines() {
+        engines_.clear();
+        engines_.push_back(std::make_shared<DirectEngine>());
+        engines_.push_back(std::make_shared<SimdDirectEngine>());
+        tree_ = std::make_shared<BarnesHutEngine>();
+        engines_.push_back(tree_);
+        fmm_ = std::make_shared<FmmEngine>();
+        engines_.push_back(fmm_);
+        pm_ = std::make_shared<PmEngine>();
+        engines_.push_back(pm_);
+        p3m_ = std::make_shared<P3mEngine>();
+        engines_.push_back(p3m_);
+        for (auto & e : engines_) {
+            e->SetGravitationalConstant(c_GravitationalConstant);
+            e->SetThreadPool(pool_);
+        }
+        engine_ = engines_[0];
+    }
+    void InitIntegrators() {
+        integrators_.clear();
+        integrators_.push_back(std::make_shared<SplittingIntegrator<SemiImplicitEuler>>());
+        integrators_.push_back(std::make_shared<SplittingIntegrator<Leapfrog>>());
+        integrators_.push_back(std::make_shared<SplittingIntegrator<Yoshida4>>());
+        integrators_.push_back(std::make_shared<SplittingIntegrator<Yoshida6>>());
+        integrators_.push_back(std::make_shared<KeplerIntegrator>());
+        integrators_.push_back(std::make_shared<WisdomHolmanIntegrator>());
+        integrators_.push_back(std::make_shared<BlockStepIntegrator>());
+        adaptive_ = std::make_shared<DormandPrinceIntegrator>();
+        integrators_.push_back(adaptive_);
+        ias15_ = std::make_shared<Ias15Integrator>();
+        integrators_.push_back(ias15_);
+        for (auto & i : integrators_) {
+            i->SetThreadPool(pool_);
+        }
+        integrator_ = integrators_[0];
+    }
+    void SetSoftening(const double & eps) {
+        for (auto & e : engines_) {
+            e->SetSoftening(eps);
+        }
+        tracers_.Invalidate();
+    }
+    void InitSolar() {
+        bodies_.Clear();
+        SetSoftening(0.0);
+
+        // Sun carries the opposite of Earth's momentum so the pair's
+        // barycentre stays put.
+        const double sun_vy = c_EarthOrbitalSpeed * c_EarthMass / c_SunMass;
+        bodies_.Add(0.0, 0.0, 0.0, sun_vy, c_SunMass);
+        bodies_.Add(c_AstronomicalUnit, 0.0, 0.0, -c_EarthOrbitalSpeed, c_EarthMass);
+    }
+    // Sun plus a thin disk of Earth-mass bodies on circular orbits between
+    // 0.5 and 3 AU, for exercising the large-N engines.
+    void InitDisk(const int count) {
+        bodies_.Clear();
+        bodies_.Reserve(count + 1);
+        SetSoftening(0.001 * c_AstronomicalUnit);
+
+        bodies_.Add(0.0, 0.0, 0.0, 0.0, c_SunMass);
+        std::mt19937 rng(12345);
+        std::uniform_real_distribution<double> radius(0.5 * c_AstronomicalUnit, 3.0 * c_AstronomicalUnit);
+        std::uniform_real_distribution<double> angle(0.0, 2.0 * k_Pi);
+        for (int i = 0; i < count; ++i) {
+            const double r = radius(rng);
+            const double a = angle(rng);
+            const double v = sqrt(c_GravitationalConstant * c_SunMass / r);
+            bodies_.Add(r * cos(a), r * sin(a), v * sin(a), -v * cos(a), c_EarthMass);
+        }
+    }
+    // Sun, Earth, Mars and Jupiter with a belt of massless tracers between
+    // 2.1 and 3.3 AU, the test-particle workload.
+    void InitBelt(const int count) {
+        bodies_.Clear();
+        SetSoftening(0.0);
+
+        // Radius in AU, mass in Earth masses, starting angle in degrees.
+        const double planets[][3] = {
+            { 1.000, 1.0, 0.0 },
+            { 1.524, 0.107, 120.0 },
+            { 5.203, 317.8, 240.0 },
+        };
+        bodies_.Add(0.0, 0.0, 0.0, 0.0, c_SunMass);
+        double px = 0.0;
+        double py = 0.0;
+        for (const auto & p : planets) {
+            const double r = p[0] * c_AstronomicalUnit;
+            const double m = p[1] * c_EarthMass;
+            const double a = p[2] * k_Deg2Rad;
+            const double v = sqrt(c_GravitationalConstant * c_SunMass / r);
+            bodies_.Add(r * cos(a), r * sin(a), v * sin(a), -v * cos(a), m);
+            px += m * v * sin(a);
+            py -= m * v * cos(a);
+        }
+        // The Sun cancels the planets' momentum so the barycentre stays put.
+        bodies_.vx[0] = -px / c_SunMass;
+        bodies_.vy[0] = -py / c_SunMass;
+
+        tracers_.Reserve(count);
+        std::mt19937 rng(12345);
+        std::uniform_real_distribution<double> radius(2.1 * c_AstronomicalUnit, 3.3 * c_AstronomicalUnit);
+        std::uniform_real_distribution<double> angle(0.0, 2.0 * k_Pi);
+        for (int i = 0; i < count; ++i) {
+            const double r = radius(rng);
+            const double a = angle(rng);
+            const double v = sqrt(c_GravitationalConstant * c_SunMass / r);
+            tracers_.Add(r * cos(a), r * sin(a), v * sin(a), -v * cos(a));
+        }
+    }
+};
+
+#endif // SIMULATION_HPP
@@ -0,0 +1,259 @@
+#ifndef THREAD_POOL_HPP
+#define THREAD_POOL_HPP
+
+#include "Logger.hpp"
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <cstddef>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+// Work-stealing pool for data-parallel loops. ParallelFor() cuts a range into
+// chunks and deals contiguous runs of them to the workers' own deques; idle
+// workers steal from the far end of someone else's deque. The calling thread
+// works too, so a pool of N threads starts N - 1 workers and nested calls
+// cannot deadlock.
+class ThreadPool {
+public:
+    typedef std::function<void(size_t, size_t)> RangeFunction;
+
+private:
+    struct Job {
+        const RangeFunction * fn;
+        std::atomic<size_t> remaining;
+        std::mutex error_mutex;
+        std::exception_ptr error;
+    };
+    struct Chunk {
+        Job * job;
+        size_t begin;
+        size_t end;
+    };
+    struct Queue {
+        std::mutex mutex;
+        std::deque<Chunk> chunks;
+    };
+    // Which pool a thread works for, and its slot there.
+    struct Identity {
+        const ThreadPool * pool;
+        size_t slot;
+    };
+
+    std::vector<std::unique_ptr<Queue>> queues_;  // one per thread, caller last
+    std::vector<std::thread> workers_;
+    std::atomic<bool> running_;
+    std::atomic<size_t> queued_;
+    std::mutex sleep_mutex_;
+    std::condition_variable wake_;
+
+public:
+    // threads == 0 uses every hardware thread. With pin set, worker k is
+    // bound to core k + 1 and the calling thread is left alone.
+    explicit ThreadPool(size_t threads = 0, const bool pin = false)
+    : running_(true)
+    , queued_(0)
+    {
+        if (threads == 0) {
+            threads = std::thread::hardware_concurrency();
+        }
+        if (threads == 0) {
+            threads = 1;
+        }
+        for (size_t k = 0; k < threads; ++k) {
+            queues_.emplace_back(new Queue);
+        }
+        for (size_t k = 0; k + 1 < threads; ++k) {
+            workers_.emplace_back(&ThreadPool::Work, this, k);
+            if (pin) {
+                Pin(workers_.back(), k + 1);
+            }
+        }
+        L_DEBUG("ThreadPool started with %zu threads.", threads);
+    }
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(sleep_mutex_);
+            running_ = false;
+        }
+        wake_.notify_all();
+        for (auto & w : workers_) {
+            w.join();
+        }
+    }
+    size_t Threads() const {
+        return queues_.size();
+    }
+    // The calling thread's slot in [0, Threads()), for per-thread scratch.
+    // Workers have their own; every thread outside the pool gets the last
+    // one, so such scratch assumes one outside caller at a time.
+    size_t Slot() const {
+        const Identity & id = Current();
+        return id.pool == this ? id.slot : queues_.size() - 1;
+    }
+    // Runs fn(begin, end) over [begin, end) in chunks of at most grain items
+    // and returns when all chunks are done. The first exception thrown by a
+    // chunk is rethrown here.
+    void ParallelFor(const size_t begin, const size_t end, size_t grain, const RangeFunction & fn) {
+        if (end <= begin) {
+            return;
+        }
+        if (grain == 0) {
+            grain = 1;
+        }
+        const size_t count = (end - begin + grain - 1) / grain;
+        if (count == 1 || queues_.size() == 1) {
+            fn(begin, end);
+            return;
+        }
+
+        Job job;
+        job.fn = &fn;
+        job.remaining = count;
+
+        // Counted before the chunks are visible so queued_ never undercounts.
+        {
+            std::lock_guard<std::mutex> lock(sleep_mutex_);
+            queued_ += count;
+        }
+
+        // Contiguous runs per queue keep neighbouring chunks on one core.
+        const size_t threads = queues_.size();
+        const size_t per_queue = (count + threads - 1) / threads;
+        size_t chunk = 0;
+        for (size_t q = 0; q < threads && chunk < count; ++q) {
+            std::lock_guard<std::mutex> lock(queues_[q]->mutex);
+            for (size_t c = 0; c < per_queue && chunk < count; ++c, ++chunk) {
+                const size_t b = begin + chunk * grain;
+                const size_t e = (b + grain < end) ? b + grain : end;
+                queues_[q]->chunks.push_back(Chunk{ &job, b, e });
+            }
+        }
+        wake_.notify_all();
+
+        // Callers share the last queue and help until their job is drained.
+        const size_t self = threads - 1;
+        while (job.remaining.load(std::memory_order_acquire) > 0) {
+            if (!RunOne(self)) {
+                std::this_thread::yield();
+            }
+        }
+        if (job.error) {
+            std::rethrow_exception(job.error);
+        }
+    }
+
+private:
+    bool Pop(const size_t q, Chunk & chunk) {
+        Queue & queue = *queues_[q];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (queue.chunks.empty()) {
+            return false;
+        }
+        chunk = queue.chunks.front();
+        queue.chunks.pop_front();
+        return true;
+    }
+    bool Steal(const size_t q, Chunk & chunk) {
+        Queue & queue = *queues_[q];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (queue.chunks.empty()) {
+            return false;
+        }
+        chunk = queue.chunks.back();
+        queue.chunks.pop_back();
+        return true;
+    }
+    bool RunOne(const size_t self) {
+        Chunk chunk;
+        bool found = Pop(self, chunk);
+        for (size_t k = 1; !found && k < queues_.size(); ++k) {
+            found = Steal((self + k) % queues_.size(), chunk);
+        }
+        if (!found) {
+            return false;
+        }
+        --queued_;
+        Job & job = *chunk.job;
+        try {
+            (*job.fn)(chunk.begin, chunk.end);
+        }
+        catch (...) {
+            std::lock_guard<std::mutex> lock(job.error_mutex);
+            if (!job.error) {
+                job.error = std::current_exception();
+            }
+        }
+        job.remaining.fetch_sub(1, std::memory_order_release);
+        return true;
+    }
+    static Identity & Current() {
+        static thread_local Identity id = { nullptr, 0 };
+        return id;
+    }
+    void Work(const size_t self) {
+        Current() = Identity{ this, self };
+        while (true) {
+            if (RunOne(self)) {
+                continue;
+            }
+            std::unique_lock<std::mutex> lock(sleep_mutex_);
+            wake_.wait(lock, [this] { return !running_ || queued_ > 0; });
+            if (!running_) {
+                return;
+            }
+        }
+    }
+    static void Pin(std::thread & thread, const size_t core) {
+        const size_t cores = std::thread::hardware_concurrency();
+        if (cores == 0) {
+            return;
+        }
+#ifdef _WIN32
+        SetThreadAffinityMask(thread.native_handle(), DWORD_PTR(1) << (core % cores));
+#else
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(core % cores, &set);
+        if (pthread_setaffinity_np(thread.native_handle(), sizeof(set), &set) != 0) {
+            L_WARN("ThreadPool: unable to pin worker to core %zu.", core);
+        }
+#endif
+    }
+};
+
+// Runs fn over [begin, end) on pool, or inline when there is none.
+inline void ParallelFor(ThreadPool * pool, const size_t begin, const size_t end, const size_t grain, const ThreadPool::RangeFunction & fn) {
+    if (pool == nullptr) {
+        fn(begin, end);
+    } else {
+        pool->ParallelFor(begin, end, grain, fn);
+    }
+}
+
+// Threads that may run chunks of pool at once, and the caller's slot among
+// them; one and zero without a pool.
+inline size_t PoolThreads(const ThreadPool * pool) {
+    return pool == nullptr ? 1 : pool->Threads();
+}
+inline size_t PoolSlot(const ThreadPool * pool) {
+    return pool == nullptr ? 0 : pool->Slot();
+}
+
+#endif // THREAD_POOL_HPP
@@ -0,0 +1,140 @@
+#ifndef TRACERS_HPP
+#define TRACERS_HPP
+
+#include "AlignedArray.hpp"
+#include "GravityKernel.hpp"
+#include "Particles.hpp"
+#include "ThreadPool.hpp"
+
+#include <cstddef>
+
+// Massless test particles: rings, debris and belts in the field of the
+// massive bodies. They feel every massive body but pull on nothing, so N
+// tracers around M bodies cost N * M pair terms instead of (N + M)^2, and
+// the massive bodies are integrated exactly as if the tracers were absent.
+//
+// Tracers keep their own structure-of-arrays block, never reordered, and
+// follow kick-drift-kick leapfrog around the massive step: Begin() kicks half
+// a step with the fields at the start and drifts, the massive bodies take
+// their step, and End() kicks the other half with the fields at the end.
+// That is always one fixed leapfrog step of the outer dt: when Dormand-Prince,
+// IAS15 or block steps sub-step the massive bodies, the tracers see only the
+// end points, so a tracer passing close to a massive body is no more accurate
+// than leapfrog at dt. Fields come from the SIMD gravity kernel with the
+// tracers as targets and the massive bodies as sources, so the inner loop
+// holds one tracer per lane and broadcasts the few sources.
+class Tracers {
+public:
+    typedef AlignedArray<double> Array;
+
+    Array x, y;
+    Array vx, vy;
+    Array ax, ay;
+
+private:
+    enum {
+        // Tracers per pool chunk; a few massive sources keep each one cheap,
+        // so chunks are large enough to amortise the hand-off.
+        k_Grain = 4096,
+    };
+
+    GravityKernel kernel_;
+    bool valid_;
+
+public:
+    Tracers() : valid_(false) {}
+    ~Tracers() {}
+
+    size_t Size() const { return x.Size(); }
+    bool Empty() const { return x.Empty(); }
+
+    void Reserve(const size_t count) {
+        x.Reserve(count);
+        y.Reserve(count);
+        vx.Reserve(count);
+        vy.Reserve(count);
+        ax.Reserve(count);
+        ay.Reserve(count);
+    }
+    void Add(const double & px, const double & py, const double & pvx, const double & pvy) {
+        x.PushBack(px);
+        y.PushBack(py);
+        vx.PushBack(pvx);
+        vy.PushBack(pvy);
+        ax.PushBack(0.0);
+        ay.PushBack(0.0);
+        valid_ = false;
+    }
+    void Clear() {
+        x.Clear();
+        y.Clear();
+        vx.Clear();
+        vy.Clear();
+        ax.Clear();
+        ay.Clear();
+        valid_ = false;
+    }
+    // The cached fields no longer match the massive bodies; called when the
+    // softening changes.
+    void Invalidate() {
+        valid_ = false;
+    }
+    // First half of a step: half kick and full drift. The massive bodies
+    // must still be at the start of the step.
+    void Begin(ThreadPool * pool, const Particles & massive, const double & g, const double & eps2, const double & dt) {
+        if (Empty()) {
+            return;
+        }
+        if (!valid_) {
+            Accelerate(pool, massive, g, eps2);
+        }
+        const double h = 0.5 * dt;
+        double * px = x.Data();
+        double * py = y.Data();
+        double * pvx = vx.Data();
+        double * pvy = vy.Data();
+        const double * pax = ax.Data();
+        const double * pay = ay.Data();
+        ParallelFor(pool, 0, Size(), k_Grain, [=](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; ++i) {
+                pvx[i] += pax[i] * h;
+                pvy[i] += pay[i] * h;
+                px[i] += pvx[i] * dt;
+                py[i] += pvy[i] * dt;
+            }
+        });
+        valid_ = false;
+    }
+    // Second half: fields at the massive bodies' new positions and the
+    // closing half kick. Those fields open the next step.
+    void End(ThreadPool * pool, const Particles & massive, const double & g, const double & eps2, const double & dt) {
+        if (Empty()) {
+            return;
+        }
+        Accelerate(pool, massive, g, eps2);
+        const double h = 0.5 * dt;
+        double * pvx = vx.Data();
+        double * pvy = vy.Data();
+        const double * pax = ax.Data();
+        const double * pay = ay.Data();
+        ParallelFor(pool, 0, Size(), k_Grain, [=](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; ++i) {
+                pvx[i] += pax[i] * h;
+                pvy[i] += pay[i] * h;
+            }
+        });
+    }
+
+private:
+    // Removed massive bodies have zero mass and so add nothing.
+    void Accelerate(ThreadPool * pool, const Particles & massive, const double & g, const double & eps2) {
+        const KernelTargets targets = { x.Data(), y.Data(), ax.Data(), ay.Data() };
+        const KernelSources sources = { massive.x.Data(), massive.y.Data(), massive.m.Data(), massive.Size() };
+        ParallelFor(pool, 0, Size(), k_Grain, [&](size_t begin, size_t end) {
+            kernel_.Evaluate(targets, begin, end, sources, g, eps2);
+        });
+        valid_ = true;
+    }
+};
+
+#endif // TRACERS_HPP
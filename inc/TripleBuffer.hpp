@@ -0,0 +1,57 @@
+#ifndef TRIPLE_BUFFER_HPP
+#define TRIPLE_BUFFER_HPP
+
+#include <atomic>
+#include <cstdint>
+
+// Lock-free single-producer / single-consumer triple buffer. The writer fills
+// Back() and calls Publish(); the reader calls Update() and then reads Front().
+// Neither side ever waits, each owns its slot exclusively, and the reader
+// always ends up on the newest complete frame. Slots are reused, so once they
+// have grown to size nothing is allocated per frame.
+template<typename T>
+class TripleBuffer {
+private:
+    enum {
+        k_IndexMask = 0x3,
+        k_Fresh = 0x4,
+    };
+
+    // Own cache line per slot so writer and reader never share one.
+    struct alignas(64) Slot {
+        T value;
+    };
+
+    Slot slots_[3];
+    alignas(64) std::atomic<uint8_t> middle_;  // spare slot index | k_Fresh
+    alignas(64) uint8_t back_;                 // writer side only
+    alignas(64) uint8_t front_;                // reader side only
+
+public:
+    TripleBuffer() : middle_(1), back_(0), front_(2) {}
+    ~TripleBuffer() {}
+
+    // Writer side.
+    T & Back() {
+        return slots_[back_].value;
+    }
+    void Publish() {
+        const uint8_t old = middle_.exchange(back_ | k_Fresh, std::memory_order_acq_rel);
+        back_ = old & k_IndexMask;
+    }
+
+    // Reader side. Returns true if a newer frame was picked up.
+    bool Update() {
+        if ((middle_.load(std::memory_order_relaxed) & k_Fresh) == 0) {
+            return false;
+        }
+        const uint8_t old = middle_.exchange(front_, std::memory_order_acq_rel);
+        front_ = old & k_IndexMask;
+        return true;
+    }
+    const T & Front() const {
+        return slots_[front_].value;
+    }
+};
+
+#endif // TRIPLE_BUFFER_HPP
@@ -0,0 +1,167 @@
+#ifndef WISDOM_HOLMAN_HPP
+#define WISDOM_HOLMAN_HPP
+
+#include "Integrator.hpp"
+#include "Kepler.hpp"
+#include "Logger.hpp"
+
+#include <atomic>
+#include <vector>
+
+// Wisdom-Holman mixed-variable symplectic integrator in democratic
+// heliocentric coordinates (Duncan, Levison & Lee 1998): heliocentric
+// positions, barycentric velocities. The dominant motion around the heaviest
+// body is an exact Kepler drift, so only the planet-planet interactions limit
+// the step; about 1/20 of the shortest orbit is typical. One step is
+//   kick(dt/2) jump(dt/2) kepler(dt) jump(dt/2) kick(dt/2)
+// and the closing kick's accelerations are reused by the next step.
+class WisdomHolmanIntegrator : public Integrator {
+private:
+    // Every body except the central one, heliocentric. The interaction kick
+    // runs the active force engine on this set, so the central attraction is
+    // never part of it (tree engines would otherwise smear it into cells).
+    Particles planets_;
+    std::vector<size_t> index_;
+    size_t central_;
+    bool warned_;
+
+public:
+    WisdomHolmanIntegrator() : central_(0), warned_(false) {}
+    ~WisdomHolmanIntegrator() {}
+    const char * Name() const override {
+        return "Wisdom-Holman (DH)";
+    }
+    void Step(Particles & bodies, ForceEngine & engine, const double & dt) override {
+        const size_t central = bodies.Heaviest();
+        if (central >= bodies.Size()) {
+            return;
+        }
+        if (!valid_ || central != central_ || planets_.Size() + 1 != bodies.Size()) {
+            valid_ = false;
+            Gather(bodies, central);
+        }
+
+        const double mc = bodies.m[central];
+        double mass = mc;
+        double cx = mc * bodies.x[central];
+        double cy = mc * bodies.y[central];
+        double cvx = mc * bodies.vx[central];
+        double cvy = mc * bodies.vy[central];
+        for (size_t k = 0; k < index_.size(); ++k) {
+            const size_t i = index_[k];
+            mass += bodies.m[i];
+            cx += bodies.m[i] * bodies.x[i];
+            cy += bodies.m[i] * bodies.y[i];
+            cvx += bodies.m[i] * bodies.vx[i];
+            cvy += bodies.m[i] * bodies.vy[i];
+        }
+        cx /= mass;
+        cy /= mass;
+        cvx /= mass;
+        cvy /= mass;
+
+        // To democratic heliocentric coordinates.
+        Particles & p = planets_;
+        const size_t n = p.Size();
+        for (size_t k = 0; k < n; ++k) {
+            const size_t i = index_[k];
+            p.x[k] = bodies.x[i] - bodies.x[central];
+            p.y[k] = bodies.y[i] - bodies.y[central];
+            p.vx[k] = bodies.vx[i] - cvx;
+            p.vy[k] = bodies.vy[i] - cvy;
+            p.m[k] = bodies.m[i];
+        }
+
+        if (!valid_) {
+            engine.Compute(p);
+            valid_ = true;
+        }
+        Kick(0.5 * dt);
+        Jump(mc, 0.5 * dt);
+        Drift(engine.GetGravitationalConstant() * mc, dt);
+        Jump(mc, 0.5 * dt);
+        engine.Compute(p);
+        Kick(0.5 * dt);
+
+        // Back to barycentric-frame positions and velocities.
+        cx += cvx * dt;
+        cy += cvy * dt;
+        double sx = 0.0, sy = 0.0, spx = 0.0, spy = 0.0;
+        for (size_t k = 0; k < n; ++k) {
+            sx += p.m[k] * p.x[k];
+            sy += p.m[k] * p.y[k];
+            spx += p.m[k] * p.vx[k];
+            spy += p.m[k] * p.vy[k];
+        }
+        const double xc = cx - sx / mass;
+        const double yc = cy - sy / mass;
+        bodies.x[central] = xc;
+        bodies.y[central] = yc;
+        bodies.vx[central] = cvx - spx / mc;
+        bodies.vy[central] = cvy - spy / mc;
+        for (size_t k = 0; k < n; ++k) {
+            const size_t i = index_[k];
+            bodies.x[i] = xc + p.x[k];
+            bodies.y[i] = yc + p.y[k];
+            bodies.vx[i] = cvx + p.vx[k];
+            bodies.vy[i] = cvy + p.vy[k];
+        }
+    }
+
+private:
+    void Gather(const Particles & bodies, const size_t central) {
+        central_ = central;
+        planets_.Clear();
+        index_.clear();
+        for (size_t i = 0; i < bodies.Size(); ++i) {
+            if (i == central) {
+                continue;
+            }
+            planets_.Add(0.0, 0.0, 0.0, 0.0, bodies.m[i]);
+            index_.push_back(i);
+        }
+    }
+    // Planet-planet interactions only.
+    void Kick(const double & h) {
+        Particles & p = planets_;
+        for (size_t k = 0; k < p.Size(); ++k) {
+            p.vx[k] += p.ax[k] * h;
+            p.vy[k] += p.ay[k] * h;
+        }
+    }
+    // Linear drift from the central body's share of the total momentum.
+    void Jump(const double & mc, const double & h) {
+        Particles & p = planets_;
+        double px = 0.0, py = 0.0;
+        for (size_t k = 0; k < p.Size(); ++k) {
+            px += p.m[k] * p.vx[k];
+            py += p.m[k] * p.vy[k];
+        }
+        const double dx = px * h / mc;
+        const double dy = py * h / mc;
+        for (size_t k = 0; k < p.Size(); ++k) {
+            p.x[k] += dx;
+            p.y[k] += dy;
+        }
+    }
+    // A body whose solve fails keeps its state for this drift.
+    void Drift(const double & mu, const double & h) {
+        Particles & p = planets_;
+        std::atomic<size_t> failed(0);
+        ParallelFor(pool_.get(), 0, p.Size(), k_StreamGrain, [&](size_t begin, size_t end) {
+            size_t count = 0;
+            for (size_t k = begin; k < end; ++k) {
+                if (!KeplerPropagate(mu, p.x[k], p.y[k], p.vx[k], p.vy[k], h)) {
+                    ++count;
+                }
+            }
+            failed += count;
+        });
+        if (failed > 0 && !warned_) {
+            L_WARN("WisdomHolmanIntegrator: Kepler drift did not converge for %zu bodies.", static_cast<size_t>(failed));
+            warned_ = true;
+        }
+    }
+};
+
+#endif // WISDOM_HOLMAN_HPP